@@ -0,0 +1,19 @@
+#version 430 core
+
+layout(location = 0) out vec4 color_out;
+
+layout(binding = 0) uniform sampler2D accumbuffer;
+layout(binding = 1) uniform sampler2D revealbuffer;
+
+// Blended over the opaque colour with (1 - alpha, alpha), see resolveOIT()
+void main() {
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    float reveal = texelFetch(revealbuffer, p, 0).r;
+    if (reveal >= 1.0) discard; // nothing transparent here
+
+    vec4 accum = texelFetch(accumbuffer, p, 0);
+    // the fp16 sum may overflow with many bright layers
+    if (isinf(max(max(abs(accum.r), abs(accum.g)), abs(accum.b)))) accum.rgb = vec3(accum.a);
+
+    color_out = vec4(accum.rgb / max(accum.a, 1e-5), reveal);
+}
@@ -6,100 +6,113 @@ in layout(location = 2) vec2 UV;
 in layout(location = 3) vec4 color;
 in layout(location = 4) vec3 tangent;
 in layout(location = 5) vec3 bitangent;
+in layout(location = 6) flat uint object;
 
 layout(binding = 0) uniform sampler2D diffuseTexture;
 layout(binding = 1) uniform sampler2D normalTexture;
 layout(binding = 2) uniform sampler2D displacementTexture;
 layout(binding = 3) uniform sampler2D reflectionTexture;
-uniform float displacementCoefficient;
-
-uniform mat4 MVP;
-uniform mat4 MV;
-uniform mat4 MVnormal;
-
-// material
-uniform float opacity;
-uniform float shininess;
-uniform float backlight_strength;
-uniform float reflexiveness;
-uniform vec3 diffuse_color;
-uniform vec3 specular_color;
-uniform vec3 emissive_color;
-uniform vec3 backlight_color;
-
-uniform vec3 fog_color;
-uniform float fog_strength;
-
-uniform bool isIlluminated;
-uniform bool isTextured;
-uniform bool isVertexColored;
-uniform bool isNormalMapped;
-uniform bool isDisplacementMapped;
-uniform bool isReflectionMapped;
-uniform bool isInverted;
-
-// lights
+
+// Compiled with a #define per material flag set on the node, see
+// shaderFeatureDefines() and SceneNode::shaderFeatures()
+
+// uniform and storage blocks, keep in sync with simple.vert and uniformBlocks.hpp
 struct Light { // point lights, coordinates in MV space
-    vec3 position;
-    vec3 attenuation; // 1 / (x + y*l + z*l*l)
-    vec3 color;
-    
-    bool is_spot; // false means point light
-    vec3 spot_direction;
+    vec3  position;
     float spot_cuttof_cos;
+    vec3  attenuation; // 1 / (x + y*l + z*l*l)
+    bool  is_spot; // false means point light
+    vec3  color;
+    vec3  spot_direction;
 };
 
 #define N_LIGHTS 7
-uniform Light light[N_LIGHTS];
+layout(std140, binding = 0) uniform FrameBlock {
+    Light light[N_LIGHTS];
+    mat4  P;
+    vec3  fog_color;
+    float fog_strength;
+    float time;
+};
+
+// storage buffers, refilled every frame
+struct Material {
+    vec3  diffuse_color;
+    float opacity;
+    vec3  specular_color;
+    float shininess;
+    vec3  emissive_color;
+    float reflexiveness;
+    vec3  backlight_color;
+    float backlight_strength;
+    vec2  uvOffset;
+    float displacementCoefficient;
+    float alphaCutoff; // with ALPHA_TESTED
+};
+layout(std430, binding = 1) readonly buffer MaterialBuffer {
+    Material materials[]; // indexed by Object.material
+};
+
+struct Object {
+    mat4 MVP;
+    mat4 MV;
+    mat4 MVnormal;
+    uint material;
+};
+layout(std430, binding = 0) readonly buffer ObjectBuffer {
+    Object objects[]; // indexed by the instance attribute
+};
+
+Material material; // of this object, loaded first thing in main()
 
 
 layout(location = 0) out vec4 color_out;
+layout(location = 1) out vec4 accum_out;  // weighted blended OIT, only
+layout(location = 2) out float reveal_out; // bound in the transparent pass
 
 
 vec3 reflection(vec3 basecolor, vec3 nnormal) {
+    mat4 MVnormal = objects[object].MVnormal;
     vec3 up    = normalize(vec3(MVnormal * vec4(vec3(0.0, 0.0, 1.0), 1.0)));
     vec3 north = normalize(vec3(MVnormal * vec4(vec3(1.0, 0.0, 0.0), 1.0)));
     float u = acos(dot(reflect(normalize(vertex), nnormal), north)) / -3.141592;
     float v = acos(dot(reflect(normalize(vertex), nnormal), up   )) / -3.141592;
     vec3 reflection = texture(reflectionTexture, vec2(u, v)).rgb;
-    return (reflexiveness < 0) 
-        ? basecolor * mix(vec3(0.0), reflection, -reflexiveness)
-        : mix(basecolor, reflection, reflexiveness);
+    return (material.reflexiveness < 0) 
+        ? basecolor * mix(vec3(0.0), reflection, -material.reflexiveness)
+        : mix(basecolor, reflection, material.reflexiveness);
 }
 
 vec3 get_nnormal() {
-    if (isNormalMapped) {
-        mat3 TBN;
-        if (isDisplacementMapped) {
-            float o = texture(displacementTexture, UV).r * 2.0 - 1.0;
-            float u = (texture(displacementTexture, UV + vec2(0.0001, 0.0)).r*2.0-1.0 - o) / 0.0004; // magic numbers are great
-            float v = (texture(displacementTexture, UV + vec2(0.0, 0.0001)).r*2.0-1.0 - o) / 0.0004; // magic numbers are great
-            TBN = mat3(
-                normalize(tangent   + normal*u),
-                normalize(bitangent + normal*v),
-                normalize(cross(tangent + normal*u, bitangent + normal*v))
-            );
-        }
-        else {
-            TBN = mat3(
-                normalize(tangent),
-                normalize(bitangent),
-                normalize(normal)
-            );
-        }
-        return TBN * normalize(texture(normalTexture, UV).rgb * 2.0 - 1.0);
-    }
-    else {
-        if (isDisplacementMapped) {
-            float o = texture(displacementTexture, UV).r * 2.0 - 1.0;
-            float u = (texture(displacementTexture, UV + vec2(0.00001, 0.0)).r*2.0-1.0 - o) / 0.00004;
-            float v = (texture(displacementTexture, UV + vec2(0.0, 0.00001)).r*2.0-1.0 - o) / 0.00004;
-            return normalize(cross(tangent + normal*u, bitangent + normal*v));
-        }
-        else {
-            return normalize(normal);
-        }
-    }
+#if defined(NORMAL_MAPPED)
+    mat3 TBN;
+  #if defined(DISPLACEMENT_MAPPED)
+    float o = texture(displacementTexture, UV).r * 2.0 - 1.0;
+    float u = (texture(displacementTexture, UV + vec2(0.0001, 0.0)).r*2.0-1.0 - o) / 0.0004; // magic numbers are great
+    float v = (texture(displacementTexture, UV + vec2(0.0, 0.0001)).r*2.0-1.0 - o) / 0.0004; // magic numbers are great
+    TBN = mat3(
+        normalize(tangent   + normal*u),
+        normalize(bitangent + normal*v),
+        normalize(cross(tangent + normal*u, bitangent + normal*v))
+    );
+  #else
+    TBN = mat3(
+        normalize(tangent),
+        normalize(bitangent),
+        normalize(normal)
+    );
+  #endif
+    // BC5 compressed normal maps only keep x and y, z is always towards the surface
+    vec2 xy = texture(normalTexture, UV).rg * 2.0 - 1.0;
+    return TBN * normalize(vec3(xy, sqrt(max(0.0, 1.0 - dot(xy, xy)))));
+#elif defined(DISPLACEMENT_MAPPED)
+    float o = texture(displacementTexture, UV).r * 2.0 - 1.0;
+    float u = (texture(displacementTexture, UV + vec2(0.00001, 0.0)).r*2.0-1.0 - o) / 0.00004;
+    float v = (texture(displacementTexture, UV + vec2(0.0, 0.00001)).r*2.0-1.0 - o) / 0.00004;
+    return normalize(cross(tangent + normal*u, bitangent + normal*v));
+#else
+    return normalize(normal);
+#endif
 }
 
 vec3 phong(vec3 basecolor, vec3 nnormal) {
@@ -126,19 +139,20 @@ vec3 phong(vec3 basecolor, vec3 nnormal) {
         float diffuse_i = dot(nnormal, L);
         float specular_i = dot(reflect(-L, nnormal), -normalize(vertex));
         specular_i = (specular_i>0)
-            ? pow(specular_i, shininess)
+            ? pow(specular_i, material.shininess)
             : 0;
 
         specular_component += light[i].color * specular_i * attenuation;
         if (diffuse_i>0)  diffuse_component += light[i].color * diffuse_i * attenuation;
     }
 
-    basecolor *= (emissive_color*light[0].color + diffuse_color*diffuse_component);
+    basecolor *= (material.emissive_color*light[0].color + material.diffuse_color*diffuse_component);
 
-    if (isReflectionMapped)
-        basecolor = reflection(basecolor, nnormal);
+#ifdef REFLECTION_MAPPED
+    basecolor = reflection(basecolor, nnormal);
+#endif
 
-    return basecolor + specular_color * specular_component;
+    return basecolor + material.specular_color * specular_component;
 }
 
 const float near = 0.1;
@@ -149,23 +163,41 @@ float linearDepth() {
 }
 
 void main() {
+    material = materials[objects[object].material];
 
     vec3 nnormal = get_nnormal(); // normalized normal
-    vec4 c = vec4(vec3(1.0), opacity);
-    if (isVertexColored)    c *= color;
-    if (isTextured)         c *= texture(diffuseTexture, UV);
-    if (isInverted)         c.rgb = 1 - c.rgb;
-    if (isIlluminated)      c.rgb = phong(c.rgb, nnormal);
-    else {
-        c.rgb *= diffuse_color;
-        if (isReflectionMapped)
-            c.rgb = reflection(c.rgb, normalize(normal));
-    }
-    if (backlight_strength > 0.05)
-        c.rgb += backlight_color * clamp((dot(normalize(vertex), nnormal) + backlight_strength) / backlight_strength, 0, 1);
+    vec4 c = vec4(vec3(1.0), material.opacity);
+#ifdef VERTEX_COLORED
+    c *= color;
+#endif
+#ifdef TEXTURED
+    c *= texture(diffuseTexture, UV);
+#endif
+#ifdef ALPHA_TESTED // masked, drawn with the opaque geometry
+    if (c.a < material.alphaCutoff) discard;
+    c.a = 1.0;
+#endif
+#ifdef INVERTED
+    c.rgb = 1 - c.rgb;
+#endif
+#ifdef ILLUMINATED
+    c.rgb = phong(c.rgb, nnormal);
+#else
+    c.rgb *= material.diffuse_color;
+  #ifdef REFLECTION_MAPPED
+    c.rgb = reflection(c.rgb, normalize(normal));
+  #endif
+#endif
+    if (material.backlight_strength > 0.05)
+        c.rgb += material.backlight_color * clamp((dot(normalize(vertex), nnormal) + material.backlight_strength) / material.backlight_strength, 0, 1);
 
     float fog = linearDepth()/1500;
     if (fog_strength > 0.05) c.rgb = mix(c.rgb, fog_color, pow(fog,1.2)*fog_strength);
     
     color_out = c;
+
+    // weighted blended OIT, McGuire and Bavoil 2013. Nearer layers weigh more
+    float w = c.a * clamp(10.0 / (1e-5 + pow(linearDepth()/5.0, 2.0) + pow(linearDepth()/200.0, 6.0)), 1e-2, 3e3);
+    accum_out  = vec4(c.rgb * c.a, c.a) * w;
+    reveal_out = c.a;
 }
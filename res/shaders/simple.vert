@@ -4,34 +4,65 @@ in layout(location = 0) vec3 position;
 in layout(location = 1) vec3 normal;
 in layout(location = 2) vec2 UV;
 in layout(location = 3) vec4 color;
-in layout(location = 4) vec3 tangent;
-in layout(location = 5) vec3 bitangent;
+in layout(location = 4) vec4 tangent; // w is the handedness, see PackedVertex
+in layout(location = 6) uint instance; // per-instance, see reserveInstanceIndices()
 
 layout(binding = 0) uniform sampler2D diffuseTexture;
 layout(binding = 1) uniform sampler2D normalTexture;
 layout(binding = 2) uniform sampler2D displacementTexture;
 layout(binding = 3) uniform sampler2D reflectionTexture;
-uniform float displacementCoefficient;
-
-uniform mat4 MVP;
-uniform mat4 MV;
-uniform mat4 MVnormal;
-
-// material
-uniform vec2 uvOffset;
-uniform float opacity;
-uniform float shininess;
-uniform vec3 diffuse_color;
-uniform vec3 specular_color;
-uniform vec3 emissive_color;
-
-uniform bool isIlluminated;
-uniform bool isTextured;
-uniform bool isVertexColored;
-uniform bool isNormalMapped;
-uniform bool isDisplacementMapped;
-uniform bool isReflectionMapped;
-uniform bool isInverted;
+
+// Compiled with a #define per material flag set on the node, see
+// shaderFeatureDefines() and SceneNode::shaderFeatures()
+
+// uniform and storage blocks, keep in sync with simple.frag and uniformBlocks.hpp
+struct Light { // point lights, coordinates in MV space
+    vec3  position;
+    float spot_cuttof_cos;
+    vec3  attenuation; // 1 / (x + y*l + z*l*l)
+    bool  is_spot; // false means point light
+    vec3  color;
+    vec3  spot_direction;
+};
+
+#define N_LIGHTS 7
+layout(std140, binding = 0) uniform FrameBlock {
+    Light light[N_LIGHTS];
+    mat4  P;
+    vec3  fog_color;
+    float fog_strength;
+    float time;
+};
+
+// storage buffers, refilled every frame
+struct Material {
+    vec3  diffuse_color;
+    float opacity;
+    vec3  specular_color;
+    float shininess;
+    vec3  emissive_color;
+    float reflexiveness;
+    vec3  backlight_color;
+    float backlight_strength;
+    vec2  uvOffset;
+    float displacementCoefficient;
+    float alphaCutoff; // with ALPHA_TESTED
+};
+layout(std430, binding = 1) readonly buffer MaterialBuffer {
+    Material materials[]; // indexed by Object.material
+};
+
+struct Object {
+    mat4 MVP;
+    mat4 MV;
+    mat4 MVnormal;
+    uint material;
+};
+layout(std430, binding = 0) readonly buffer ObjectBuffer {
+    Object objects[]; // indexed by the instance attribute
+};
+
+Material material; // of this object, loaded first thing in main()
 
 out layout(location = 0) vec3 vertex_out;
 out layout(location = 1) vec3 normal_out;
@@ -39,24 +70,34 @@ out layout(location = 2) vec2 uv_out;
 out layout(location = 3) vec4 color_out;
 out layout(location = 4) vec3 tangent_out;
 out layout(location = 5) vec3 bitangent_out;
+out layout(location = 6) flat uint object_out;
 
 void main() {
+    mat4 MVP      = objects[instance].MVP;
+    mat4 MV       = objects[instance].MV;
+    mat4 MVnormal = objects[instance].MVnormal;
+    object_out = instance;
+    material = materials[objects[instance].material];
+
     vec3 displacement = vec3(0.0);
-    if (isDisplacementMapped) {
-        float o = texture(displacementTexture, UV + uvOffset).r * 2.0 - 1.0;
-        //float u = (texture(displacementTexture, UV + uvOffset + vec2(0.001, 0.0)).r*2.0-1.0 - o) / 0.004;
-        //float v = (texture(displacementTexture, UV + uvOffset + vec2(0.0, 0.001)).r*2.0-1.0 - o) / 0.004;
+#ifdef DISPLACEMENT_MAPPED
+    {
+        float o = texture(displacementTexture, UV + material.uvOffset).r * 2.0 - 1.0;
+        //float u = (texture(displacementTexture, UV + material.uvOffset + vec2(0.001, 0.0)).r*2.0-1.0 - o) / 0.004;
+        //float v = (texture(displacementTexture, UV + material.uvOffset + vec2(0.0, 0.001)).r*2.0-1.0 - o) / 0.004;
         
-        displacement = normal * displacementCoefficient * o;
+        displacement = normal * material.displacementCoefficient * o;
     }
+#endif
 
     vertex_out = vec3(MV * vec4(position+displacement, 1.0f));
     gl_Position =  MVP * vec4(position+displacement, 1.0f);
 
-    uv_out = UV + uvOffset;
+    uv_out = UV + material.uvOffset;
     color_out = color;
     
     normal_out = normalize(vec3(MVnormal * vec4(normal, 1.0f)));
-    tangent_out = normalize(vec3(MVnormal * vec4(tangent, 1.0f)));
+    vec3 bitangent = cross(normal, tangent.xyz) * tangent.w;
+    tangent_out = normalize(vec3(MVnormal * vec4(tangent.xyz, 1.0f)));
     bitangent_out = normalize(vec3(MVnormal * vec4(bitangent, 1.0f)));
 }
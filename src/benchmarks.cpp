@@ -0,0 +1,477 @@
+#include "benchmarks.hpp"
+#include "scene.hpp"
+#include "flatScene.hpp"
+#include "transparencySorter.hpp"
+#include <glad/glad.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <cstdio>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <map>
+#include <string>
+#include <vector>
+#include <utilities/shader.hpp>
+#include <utilities/timeutils.hpp>
+#include <utilities/jobSystem.hpp>
+#include <utilities/glutils.h>
+#include <utilities/shapes.h>
+#include <utilities/modelLoader.hpp>
+#include <utilities/imageLoader.hpp>
+#include <filesystem>
+
+using std::string;
+using std::vector;
+typedef unsigned int uint;
+
+// Calls `f` in batches until `seconds` have passed, returns calls per second
+static double callsPerSecond(const std::function<void()>& f, double seconds = 0.5) {
+    Clock c;
+    double elapsed = 0;
+    size_t calls = 0;
+    while (elapsed < seconds) {
+        for (uint i = 0; i < 1000; i++) f();
+        calls += 1000;
+        elapsed += c.getTimeDeltaSeconds();
+    }
+    return calls / elapsed;
+}
+
+// Uniform location lookups with the old function-local string map versus the
+// per-program hashed table. Most of what renderNode used to look up now lives
+// in uniform blocks, so this times the uniforms post.frag still has, which
+// are set every frame.
+static void benchmarkUniformLookups(GLFWwindow*) {
+    Gloom::Shader shader;
+    shader.makeBasicShader("../res/shaders/post.vert", "../res/shaders/post.frag");
+
+    static const char* names[] = {
+        "framebuffer", "depthbuffer", "windowWidth", "windowHeight", "time",
+    };
+    const uint n_lookups = sizeof(names)/sizeof(*names);
+
+    vector<string> name_strings(std::begin(names), std::end(names));
+    vector<uint32_t> name_hashes;
+    for (const string& name : name_strings) name_hashes.push_back(Gloom::uniformHash(name.c_str()));
+
+    // a lookup that misses is cheaper than one that hits, don't time those
+    uint n_active = 0;
+    for (uint32_t hash : name_hashes) if (shader.location(hash) != -1) n_active++;
+    if (n_active != n_lookups)
+        printf("warning: only %u of %u uniforms are active in post.frag\n", n_active, n_lookups);
+
+    volatile GLint sink = 0;
+
+    // the previous implementation of Shader::location()
+    GLuint program = shader.get();
+    auto old_location = [program](std::string const& name) {
+        static std::map<std::string, GLint> cache {};
+        auto it = cache.find(name);
+        if (it == cache.end())
+            return cache[name] = glGetUniformLocation(program, name.c_str());
+        return it->second;
+    };
+
+    double old_rate = callsPerSecond([&]{
+        for (const string& name : name_strings) sink = sink + old_location(name);
+    }) * n_lookups;
+
+    double string_rate = callsPerSecond([&]{
+        for (const string& name : name_strings) sink = sink + shader.location(name);
+    }) * n_lookups;
+
+    double hash_rate = callsPerSecond([&]{
+        for (uint32_t hash : name_hashes) sink = sink + shader.location(hash);
+    }) * n_lookups;
+
+    printf("uniform location lookups per second:\n");
+    printf("  %-40s %12.0f\n", "static std::map<std::string> (before)", old_rate);
+    printf("  %-40s %12.0f\n", "per-program, hashed at runtime", string_rate);
+    printf("  %-40s %12.0f\n", "per-program, precomputed hashes (after)", hash_rate);
+
+    shader.destroy();
+}
+
+static void deleteTree(SceneNode* node) {
+    for (SceneNode* child : node->children) deleteTree(child);
+    delete node;
+}
+
+// A root with clones of a ten node model until there are `n` nodes, like the
+// trees and grass. The clone roots end up in `moving`. No GL objects are made,
+// the meshes only need bounds for the transform pass.
+static SceneNode* makeSyntheticScene(size_t n, vector<SceneNode*>& moving) {
+    SceneNode* model = createSceneNode();
+    for (uint i = 0; i < 9; i++) {
+        SceneNode* part = createSceneNode();
+        part->vertexArrayObjectID = 0;
+        part->aabb_min = vec3(-1, -1, 0);
+        part->aabb_max = vec3( 1,  1, 2);
+        part->position = vec3(0, 0, i);
+        part->rotation = vec3(0, 0, i * 0.3f);
+        part->scale    = vec3(1.0f - i * 0.05f);
+        model->children.push_back(part);
+    }
+
+    SceneNode* root = createSceneNode();
+    size_t count = 1;
+    moving.clear();
+    while (count + 10 <= n) {
+        SceneNode* clone = model->clone();
+        clone->position = vec3(rand() % 1000, rand() % 1000, 0);
+        clone->rotation.z = (rand() % 31415) / 10000.0f;
+        root->children.push_back(clone);
+        moving.push_back(clone);
+        count += 10;
+    }
+    deleteTree(model);
+    return root;
+}
+
+// updateTransforms on synthetic scenes where every clone moves each frame,
+// serial versus spread over a growing job system
+static void benchmarkTransforms(GLFWwindow*) {
+    const mat4 V = glm::lookAt(vec3(500, -200, 300), vec3(500, 500, 0), vec3(0, 0, 1));
+    const mat4 P = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 5000.f);
+    const uint thread_counts[] = {1, 2, 4, 8};
+
+    printf("transform update, ms per frame (speedup over serial):\n");
+    printf("%10s %16s", "nodes", "serial");
+    for (uint threads : thread_counts) printf("   %2u threads     ", threads);
+    printf("\n");
+
+    for (size_t n : {10000, 100000, 1000000}) {
+        vector<SceneNode*> moving;
+        SceneNode* root = makeSyntheticScene(n, moving);
+        FlatScene scene;
+        bakeScene(root, scene);
+
+        // milliseconds per update, with all clones moved in between
+        auto time_updates = [&](const std::function<void()>& update) {
+            vector<double> samples;
+            Clock c;
+            double total = 0;
+            while (total < 0.5 || samples.size() < 5) {
+                for (SceneNode* node : moving) node->position.x += 0.01f;
+                c.getTimeDeltaSeconds();
+                update();
+                samples.push_back(c.getTimeDeltaSeconds());
+                total += samples.back();
+            }
+            return summarizeTimings(samples).median * 1000;
+        };
+
+        double serial = time_updates([&]{ updateTransforms(scene, V, P); });
+        printf("%10lu %16.3f", (unsigned long)scene.size(), serial);
+        for (uint threads : thread_counts) {
+            JobSystem jobs(threads);
+            double ms = time_updates([&]{ updateTransforms(scene, V, P, jobs); });
+            printf(" %8.3f (%4.2fx)", ms, serial / ms);
+        }
+        printf("\n");
+
+        deleteTree(root);
+    }
+}
+
+// Back to front ordering of n transparent draws scattered in front of a
+// slowly orbiting camera: the std::sort renderFrame used to do, versus the
+// TransparencySorter with and without reusing the previous frame's order.
+static void benchmarkTransparency(GLFWwindow*) {
+    const float far = 5000.f;
+    const mat4 P = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, far);
+
+    printf("transparent sort, microseconds per frame:\n");
+    printf("%10s %16s %16s %16s %10s\n", "nodes", "std::sort", "radix", "coherent", "fixups ok");
+
+    for (size_t n : {1000, 10000, 100000}) {
+        std::mt19937 rng(n);
+        std::uniform_real_distribution<float> coord(0.0f, 1000.0f);
+        vector<mat4> M(n);
+        for (mat4& m : M) m = glm::translate(mat4(1.0), vec3(coord(rng), coord(rng), coord(rng) * 0.05f));
+
+        vector<mat4> MV(n), MVP(n);
+        vector<uint32_t> ids(n), keys(n);
+        for (size_t i = 0; i < n; i++) ids[i] = i;
+        uint frame = 0;
+        auto next_frame = [&]{
+            float angle = frame++ * 0.002f;
+            mat4 V = glm::lookAt(vec3(500 + 900*glm::cos(angle), 500 + 900*glm::sin(angle), 300), vec3(500, 500, 0), vec3(0, 0, 1));
+            for (size_t i = 0; i < n; i++) {
+                MV[i] = V * M[i];
+                MVP[i] = P * MV[i];
+            }
+        };
+
+        // the previous implementation, including collecting the nodes
+        struct NodeDistShader {
+            SceneNode* node;
+            Gloom::Shader* s;
+            float dist;
+        };
+        vector<NodeDistShader> nodes;
+        auto old_sort = [&]{
+            nodes.clear();
+            for (size_t i = 0; i < n; i++)
+                nodes.push_back({nullptr, nullptr, glm::length(vec3(MVP[i]*vec4(0,0,0,1)))});
+            std::sort(nodes.begin(), nodes.end(), [](NodeDistShader a, NodeDistShader b) {
+                return a.dist > b.dist;
+            });
+        };
+
+        volatile uint32_t sink = 0;
+        auto new_sort = [&](TransparencySorter& sorter) {
+            for (size_t i = 0; i < n; i++)
+                keys[i] = TransparencySorter::depthKey(-MV[i][3].z, far);
+            sink = sink + sorter.sort(ids.data(), keys.data(), n).front();
+        };
+
+        // microseconds per frame, over 60 consecutive frames
+        auto time_frames = [&](const std::function<void()>& sort) {
+            frame = 0;
+            vector<double> samples;
+            Clock c;
+            for (uint i = 0; i < 60; i++) {
+                next_frame();
+                c.getTimeDeltaSeconds();
+                sort();
+                samples.push_back(c.getTimeDeltaSeconds());
+            }
+            return summarizeTimings(samples).median * 1e6;
+        };
+
+        TransparencySorter radix, coherent;
+        radix.temporal_coherence = false;
+        uint coherent_frames = 0;
+        double t_old      = time_frames(old_sort);
+        double t_radix    = time_frames([&]{ new_sort(radix); });
+        double t_coherent = time_frames([&]{
+            new_sort(coherent);
+            coherent_frames += coherent.last_path == TransparencySorter::COHERENT;
+        });
+        printf("%10lu %16.1f %16.1f %16.1f %7u/60\n",
+            (unsigned long)n, t_old, t_radix, t_coherent, coherent_frames);
+    }
+}
+
+// The layout generateBuffer used to make: one float stream per attribute,
+// tangents and bitangents included for meshes with UVs. Their contents
+// don't matter here. The buffers are appended to `buffers`.
+static uint generateSeparateBuffers(const Mesh& mesh, vector<GLuint>& buffers) {
+    uint vao;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    auto stream = [&](uint location, int components, size_t count, const void* data) {
+        GLuint id;
+        glGenBuffers(1, &id);
+        buffers.push_back(id);
+        glBindBuffer(GL_ARRAY_BUFFER, id);
+        glBufferData(GL_ARRAY_BUFFER, count * components * sizeof(float), data, GL_STATIC_DRAW);
+        glVertexAttribPointer(location, components, GL_FLOAT, GL_FALSE, components * sizeof(float), 0);
+        glEnableVertexAttribArray(location);
+    };
+    size_t n = mesh.vertices.size();
+    stream(0, 3, n, mesh.vertices.data());
+    stream(1, 3, n, mesh.normals.data());
+    if (!mesh.textureCoordinates.empty()) {
+        vector<vec3> tangents(n, vec3(1, 0, 0));
+        stream(2, 2, n, mesh.textureCoordinates.data());
+        stream(4, 3, n, tangents.data());
+        stream(5, 3, n, tangents.data());
+    }
+    if (!mesh.colors.empty())
+        stream(3, 4, n, mesh.colors.data());
+
+    GLuint indices;
+    glGenBuffers(1, &indices);
+    buffers.push_back(indices);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(uint), mesh.indices.data(), GL_STATIC_DRAW);
+    return vao;
+}
+
+// Vertex size and vertex shader throughput of the separate float streams
+// generateBuffer used to make versus the interleaved PackedVertex. The
+// shader reads every attribute, and rasterization is discarded so the
+// vertex fetch dominates.
+static void benchmarkVertexFormats(GLFWwindow*) {
+    Mesh mesh = generateSphere(10, 512, 512);
+    mesh.colors.assign(mesh.vertices.size(), vec4(1));
+
+    static const char* vertex_source = R"(
+        #version 430 core
+        in layout(location = 0) vec3 position;
+        in layout(location = 1) vec3 normal;
+        in layout(location = 2) vec2 UV;
+        in layout(location = 3) vec4 color;
+        in layout(location = 4) vec4 tangent;
+        in layout(location = 5) vec3 bitangent;
+        void main() {
+            gl_Position = vec4(position + normal + tangent.xyz * tangent.w + bitangent, 1.0)
+                + vec4(UV, 0.0, 0.0) + color;
+        }
+    )";
+    Gloom::Shader shader;
+    shader.attachSource(vertex_source, "vertex_formats.vert");
+    shader.link();
+    shader.activate();
+
+    vector<GLuint> buffers;
+    uint separate = generateSeparateBuffers(mesh, buffers);
+    uint packed = generateBuffer(mesh);
+
+    // milliseconds per draw of the whole mesh
+    auto time_draws = [&](uint vao, GLenum index_type) {
+        glBindVertexArray(vao);
+        glDrawElements(GL_TRIANGLES, mesh.indices.size(), index_type, nullptr); // warm up
+        glFinish();
+        const uint draws = 20;
+        Clock c;
+        for (uint i = 0; i < draws; i++)
+            glDrawElements(GL_TRIANGLES, mesh.indices.size(), index_type, nullptr);
+        glFinish();
+        return c.getTimeDeltaSeconds() * 1e3 / draws;
+    };
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    double t_separate = time_draws(separate, GL_UNSIGNED_INT);
+    double t_packed   = time_draws(packed, indexType(mesh));
+    glDisable(GL_RASTERIZER_DISCARD);
+
+    const size_t n = mesh.vertices.size();
+    const size_t separate_size = (3 + 3 + 2 + 4 + 3 + 3) * sizeof(float);
+    const size_t packed_size = sizeof(PackedVertex);
+    const double vertices = double(mesh.indices.size());
+
+    printf("vertex formats, %lu vertices, %lu indices:\n", (unsigned long)n, (unsigned long)mesh.indices.size());
+    printf("  %-24s %14s %14s %14s %16s\n", "", "bytes/vertex", "MiB", "ms/draw", "Mvertices/s");
+    printf("  %-24s %14lu %14.2f %14.3f %16.1f\n", "separate float streams",
+        (unsigned long)separate_size, separate_size * n / 1048576.0, t_separate, vertices / t_separate / 1e3);
+    printf("  %-24s %14lu %14.2f %14.3f %16.1f\n", "interleaved, packed",
+        (unsigned long)packed_size, packed_size * n / 1048576.0, t_packed, vertices / t_packed / 1e3);
+
+    glBindVertexArray(0);
+    glDeleteVertexArrays(1, &separate);
+    glDeleteVertexArrays(1, &packed);
+    glDeleteBuffers(buffers.size(), buffers.data());
+    shader.destroy();
+}
+
+// Startup cost of the models of the scene, imported with assimp versus
+// mapped from the baked file. A first load bakes each model and decodes its
+// textures, which stay cached, so neither timing includes texture decoding.
+static void benchmarkModelLoading(GLFWwindow*) {
+    static const char* models[][2] = {
+        {"../res/models/beetle",       "scene.gltf"},
+        {"../res/models/fur_tree",     "scene.gltf"},
+        {"../res/models/single_grass", "scene.gltf"},
+    };
+
+    struct Result { string name; double t_import, t_mapped; };
+    vector<Result> results;
+    for (auto& model : models) {
+        deleteTree(loadModelScene(model[0], model[1])); // warm up
+
+        // milliseconds until the model is loaded and uploaded
+        auto time_load = [&]() {
+            Clock c;
+            SceneNode* root = loadModelScene(model[0], model[1]);
+            glFinish();
+            double t = c.getTimeDeltaSeconds() * 1e3;
+            deleteTree(root);
+            return t;
+        };
+        std::filesystem::remove(bakedModelPath(model[0], model[1]));
+        double t_import = time_load(); // bakes it again
+        double t_mapped = time_load();
+        results.push_back({string(model[0]) + "/" + model[1], t_import, t_mapped});
+    }
+
+    printf("model loading:\n");
+    printf("  %-40s %12s %12s %10s\n", "", "import ms", "mapped ms", "speedup");
+    for (const Result& r : results)
+        printf("  %-40s %12.2f %12.2f %9.1fx\n", r.name.c_str(), r.t_import, r.t_mapped, r.t_import / r.t_mapped);
+}
+
+// Decoding the textures in res/textures, one after the other versus
+// concurrently, and the post-processing loadPNGFile() does after decoding,
+// as it was before versus now, on the decoded pixels.
+static void benchmarkTextureLoading(GLFWwindow*) {
+    vector<string> files;
+    for (auto& entry : std::filesystem::directory_iterator("../res/textures"))
+        if (entry.path().extension() == ".png") files.push_back(entry.path().string());
+    std::sort(files.begin(), files.end());
+
+    Clock c;
+    vector<PNGImage> images;
+    for (const string& file : files) images.push_back(loadPNGFile(file));
+    double t_serial = c.getTimeDeltaSeconds() * 1e3;
+    images = loadPNGFiles(files);
+    double t_parallel = c.getTimeDeltaSeconds() * 1e3;
+
+    // the previous flip and handedness inversion
+    auto old_flip = [](vector<unsigned char>& pixels, uint width, uint height) {
+        uint widthBytes = 4 * width;
+        for(uint row = 0; row < (height / 2); row++)
+            for(uint col = 0; col < widthBytes; col++)
+                std::swap(pixels[row * widthBytes + col], pixels[(height - 1 - row) * widthBytes + col]);
+    };
+    auto old_invert = [](vector<unsigned char>& pixels, uint width, uint height) {
+        uint widthBytes = 4 * width;
+        for (uint xb = 0; xb < widthBytes; xb+=4)
+        for (uint y = 0; y < height; y++) {
+            unsigned char& r = pixels[y*widthBytes + xb + 0];
+            unsigned char& g = pixels[y*widthBytes + xb + 1];
+            r = 255 - r;
+            g = 255 - g;
+        }
+    };
+
+    const uint reps = 5;
+    double t_old = 0, t_new = 0;
+    size_t bytes = 0;
+    for (PNGImage& image : images) {
+        bytes += image.pixels.size();
+        c.getTimeDeltaSeconds();
+        for (uint i = 0; i < reps; i++) {
+            old_flip(image.pixels, image.width, image.height);
+            old_invert(image.pixels, image.width, image.height);
+        }
+        t_old += c.getTimeDeltaSeconds();
+        for (uint i = 0; i < reps; i++) {
+            flipRows(image.pixels, image.width, image.height);
+            invertRedGreen(image.pixels);
+        }
+        t_new += c.getTimeDeltaSeconds();
+    }
+    t_old = t_old / reps * 1e3;
+    t_new = t_new / reps * 1e3;
+
+    printf("texture loading, %zu files, %.1f MB decoded, %u threads:\n",
+        files.size(), bytes / 1e6, jobSystem().threadCount());
+    printf("  %-40s %12s\n", "", "ms");
+    printf("  %-40s %12.2f\n", "decode one after the other", t_serial);
+    printf("  %-40s %12.2f\n", "decode concurrently", t_parallel);
+    printf("  %-40s %12.2f\n", "flip and invert, bytewise (before)", t_old);
+    printf("  %-40s %12.2f\n", "flip and invert, rows and SIMD (after)", t_new);
+}
+
+bool runMicroBenchmark(GLFWwindow* window, const string& name) {
+    static const std::map<string, std::function<void(GLFWwindow*)>> benchmarks = {
+        {"uniforms", benchmarkUniformLookups},
+        {"transforms", benchmarkTransforms},
+        {"transparency", benchmarkTransparency},
+        {"vertices", benchmarkVertexFormats},
+        {"models", benchmarkModelLoading},
+        {"textures", benchmarkTextureLoading},
+    };
+
+    auto it = benchmarks.find(name);
+    if (it == benchmarks.end()) {
+        fprintf(stderr, "Unknown micro-benchmark \"%s\", available ones are:\n", name.c_str());
+        for (auto& b : benchmarks) fprintf(stderr, "  %s\n", b.first.c_str());
+        return false;
+    }
+    it->second(window);
+    return true;
+}
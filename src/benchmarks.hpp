@@ -0,0 +1,8 @@
+#pragma once
+#include <GLFW/glfw3.h>
+#include <string>
+
+// Micro-benchmarks of isolated parts of the renderer, selected with
+// --micro-benchmark NAME. They expect a current OpenGL context, but no scene.
+// Returns false if NAME is unknown, after listing the available ones.
+bool runMicroBenchmark(GLFWwindow* window, const std::string& name);
@@ -0,0 +1,194 @@
+#include "flatScene.hpp"
+#include <cstring>
+#include <glm/gtc/matrix_transform.hpp>
+
+static void bakeNode(SceneNode* node, int parent, Gloom::ShaderPermutations* parent_shader, FlatScene& out) {
+	uint index = out.size();
+	Gloom::ShaderPermutations* s = (node->shader != nullptr)
+		? node->shader
+		: parent_shader;
+
+	vec3 mesh_min = vec3( INFINITY);
+	vec3 mesh_max = vec3(-INFINITY);
+	if (node->nodeType == GEOMETRY && node->vertexArrayObjectID != -1 && node->aabb_min.x <= node->aabb_max.x) {
+		// the vertex shader may push vertices along their normal
+		float pad = node->isDisplacementMapped ? glm::abs(node->displacementCoefficient) : 0.0f;
+		mesh_min = node->aabb_min - vec3(pad);
+		mesh_max = node->aabb_max + vec3(pad);
+	}
+
+	node->flat_index = index;
+	out.node.push_back(node);
+	out.parent.push_back(parent);
+	out.subtree_end.push_back(0);
+	out.shader.push_back(s);
+	out.mesh_min.push_back(mesh_min);
+	out.mesh_max.push_back(mesh_max);
+
+	for (SceneNode* child : node->children)
+		bakeNode(child, index, s, out);
+
+	out.subtree_end[index] = out.size();
+}
+
+void bakeScene(SceneNode* root, FlatScene& out) {
+	out = FlatScene();
+	bakeNode(root, -1, nullptr, out);
+
+	size_t n = out.size();
+	out.transform.resize(n);
+	out.local.resize(n);
+	out.M.resize(n);
+	out.Mnormal.resize(n);
+	out.changed.resize(n);
+	out.MV.resize(n);
+	out.MVP.resize(n);
+	out.MVnormal.resize(n);
+	out.bounds_min.resize(n);
+	out.bounds_max.resize(n);
+	out.subtree_geometry.resize(n);
+
+	// matches no real transform, so the first update computes everything
+	memset((void*)out.transform.data(), 0xff, n * sizeof(NodeTransform));
+}
+
+// Updates the matrices and the node's own bounds. Its parent must be done.
+static void updateNode(FlatScene& scene, size_t i, const mat4& V, const glm::mat3& Vnormal, const mat4& P) {
+	const SceneNode* node = scene.node[i];
+	NodeTransform t;
+	memset((void*)&t, 0, sizeof(t));
+	t.position       = node->position;
+	t.rotation       = node->rotation;
+	t.scale          = node->scale;
+	t.referencePoint = node->referencePoint;
+
+	bool local_changed = memcmp(&t, &scene.transform[i], sizeof(t)) != 0;
+	if (local_changed) {
+		scene.transform[i] = t;
+		scene.local[i] = (node->has_no_transforms())
+			? mat4(1.0)
+			: glm::translate(mat4(1.0), t.position)
+			* glm::translate(mat4(1.0), t.referencePoint)
+			* glm::rotate(mat4(1.0), t.rotation.z, vec3(0,0,1))
+			* glm::rotate(mat4(1.0), t.rotation.y, vec3(0,1,0))
+			* glm::rotate(mat4(1.0), t.rotation.x, vec3(1,0,0))
+			* glm::scale(mat4(1.0), t.scale)
+			* glm::translate(mat4(1.0), -t.referencePoint);
+	}
+
+	int p = scene.parent[i];
+	bool changed = local_changed || (p >= 0 && scene.changed[p]);
+	scene.changed[i] = changed;
+	if (changed) {
+		scene.M[i] = (p >= 0) ? scene.M[p] * scene.local[i] : scene.local[i];
+		scene.Mnormal[i] = glm::transpose(glm::inverse(glm::mat3(scene.M[i])));
+	}
+
+	const mat4& M = scene.M[i];
+	scene.MV[i] = V * M;
+	scene.MVP[i] = P * scene.MV[i];
+	scene.MVnormal[i] = mat4(Vnormal * scene.Mnormal[i]);
+
+	// Arvo's method, the world space box enclosing the transformed one
+	const vec3& lo = scene.mesh_min[i];
+	const vec3& hi = scene.mesh_max[i];
+	if (lo.x <= hi.x) {
+		vec3 center = (hi + lo) * 0.5f;
+		vec3 extent = (hi - lo) * 0.5f;
+		vec3 world_center = vec3(M * vec4(center, 1.0));
+		vec3 world_extent
+			= glm::abs(vec3(M[0])) * extent.x
+			+ glm::abs(vec3(M[1])) * extent.y
+			+ glm::abs(vec3(M[2])) * extent.z;
+		scene.bounds_min[i] = world_center - world_extent;
+		scene.bounds_max[i] = world_center + world_extent;
+		scene.subtree_geometry[i] = 1;
+	} else {
+		scene.bounds_min[i] = vec3( INFINITY);
+		scene.bounds_max[i] = vec3(-INFINITY);
+		scene.subtree_geometry[i] = 0;
+	}
+}
+
+static void mergeInto(FlatScene& scene, size_t parent, size_t child) {
+	scene.bounds_min[parent] = glm::min(scene.bounds_min[parent], scene.bounds_min[child]);
+	scene.bounds_max[parent] = glm::max(scene.bounds_max[parent], scene.bounds_max[child]);
+	scene.subtree_geometry[parent] += scene.subtree_geometry[child];
+}
+
+// Updates [begin, end), which must hold whole subtrees whose parents are
+// done, and merges the bounds up to the roots of those subtrees.
+static void updateRange(FlatScene& scene, size_t begin, size_t end, const mat4& V, const mat4& P) {
+	// V is rigid, so its rotation part is its own normal matrix
+	const glm::mat3 Vnormal = glm::mat3(V);
+	for (size_t i = begin; i < end; i++)
+		updateNode(scene, i, V, Vnormal, P);
+
+	// children come after their parents, so walking backwards merges every
+	// subtree into its root before that root is merged into its own parent
+	for (size_t i = end; i-- > begin;) {
+		int p = scene.parent[i];
+		if (p >= int(begin)) mergeInto(scene, p, i);
+	}
+}
+
+void updateTransforms(FlatScene& scene, const mat4& V, const mat4& P) {
+	updateRange(scene, 0, scene.size(), V, P);
+}
+
+// Splits the subtree of `i` into nodes updated up front, and runs of whole
+// sibling subtrees of about `grain` nodes which can be updated independently
+static void partition(const FlatScene& scene, uint i, size_t grain,
+		vector<uint>& serial, vector<std::pair<uint, uint>>& ranges) {
+	serial.push_back(i);
+	uint run_begin = i + 1;
+	size_t run_size = 0;
+	auto flush = [&](uint run_end) {
+		if (run_size) ranges.emplace_back(run_begin, run_end);
+		run_size = 0;
+	};
+	for (uint j = i + 1; j < scene.subtree_end[i]; j = scene.subtree_end[j]) {
+		size_t size = scene.subtree_end[j] - j;
+		if (size > grain) {
+			flush(j);
+			partition(scene, j, grain, serial, ranges);
+			run_begin = scene.subtree_end[j];
+		} else {
+			run_size += size;
+			if (run_size >= grain) {
+				flush(scene.subtree_end[j]);
+				run_begin = scene.subtree_end[j];
+			}
+		}
+	}
+	flush(scene.subtree_end[i]);
+}
+
+void updateTransforms(FlatScene& scene, const mat4& V, const mat4& P, JobSystem& jobs, size_t grain) {
+	if (scene.size() <= grain || jobs.threadCount() == 1)
+		return updateTransforms(scene, V, P);
+
+	// reused between calls, the scenes are updated one at a time
+	static vector<uint> serial;
+	static vector<std::pair<uint, uint>> ranges;
+	serial.clear();
+	ranges.clear();
+	partition(scene, 0, grain, serial, ranges);
+
+	// the ancestors of the ranges, in order
+	const glm::mat3 Vnormal = glm::mat3(V);
+	for (uint i : serial)
+		updateNode(scene, i, V, Vnormal, P);
+
+	jobs.parallelFor(ranges.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t r = begin; r < end; r++)
+			updateRange(scene, ranges[r].first, ranges[r].second, V, P);
+	});
+
+	// merge the ranges into their ancestors, deepest first
+	for (size_t k = serial.size(); k--;) {
+		uint i = serial[k];
+		for (uint j = i + 1; j < scene.subtree_end[i]; j = scene.subtree_end[j])
+			mergeInto(scene, i, j);
+	}
+}
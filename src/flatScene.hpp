@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+#include "sceneGraph.hpp"
+#include <utilities/jobSystem.hpp>
+
+// The transform inputs of a node, compared bytewise to detect changes
+struct NodeTransform {
+	vec3 position;
+	vec3 rotation;
+	vec3 scale;
+	vec3 referencePoint;
+};
+
+// A baked, flattened form of a SceneNode tree. SceneNode stays the authoring
+// API: the transform inputs and render flags are still read from the nodes,
+// but everything derived from them lives in contiguous arrays indexed by
+// the node's position in a depth-first order, in which a parent always
+// precedes its descendants. This turns the per-frame passes into linear
+// sweeps instead of recursive pointer chasing.
+// Bake again after changing the structure of the tree, its meshes, shaders
+// or displacement coefficients.
+struct FlatScene {
+	// structure, fixed at bake time
+	vector<SceneNode*> node;
+	vector<int> parent; // -1 for the root
+	vector<uint> subtree_end; // one past the last descendant
+	vector<Gloom::ShaderPermutations*> shader; // inherited from the closest ancestor with one
+	vector<vec3> mesh_min; // bounds of the mesh in model space, padded for
+	vector<vec3> mesh_max; // displacement. Empty (min > max) without one
+
+	// cached between frames, only recomputed when the transform changes
+	vector<NodeTransform> transform;
+	vector<mat4> local;
+	vector<mat4> M; // model to world
+	vector<glm::mat3> Mnormal; // transpose(inverse(mat3(M)))
+	vector<uint8_t> changed; // M was recomputed this frame
+
+	// recomputed every frame by updateTransforms()
+	vector<mat4> MV;
+	vector<mat4> MVP;
+	vector<mat4> MVnormal; // transpose(inverse(MV))
+	vector<vec3> bounds_min; // world space bounds of the node
+	vector<vec3> bounds_max; // and its subtree
+	vector<uint> subtree_geometry; // meshes in the subtree, for the culling counters
+
+	size_t size() const { return node.size(); }
+};
+
+// Flattens the tree under `root` into `out`, and stores each node's index in
+// SceneNode::flat_index
+void bakeScene(SceneNode* root, FlatScene& out);
+
+// One linear sweep updating the matrices, followed by a reverse sweep
+// merging the bounds of each subtree into its root
+void updateTransforms(FlatScene& scene, const mat4& V, const mat4& P);
+
+// The same, but with the tree split into runs of independent sibling
+// subtrees of about `grain` nodes, which are updated on the job system.
+// Their ancestors are updated before, and merged after, on this thread.
+void updateTransforms(FlatScene& scene, const mat4& V, const mat4& P, JobSystem& jobs, size_t grain = 2048);
@@ -1,12 +1,16 @@
 // Local headers
 #include "utilities/window.hpp"
 #include "program.hpp"
+#include "utilities/assetLoader.hpp"
+#include "utilities/jobSystem.hpp"
+#include "utilities/programCache.hpp"
 
 // System headers
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
 // Standard headers
+#include <algorithm>
 #include <cstdlib>
 #include <arrrgh.hpp>
 
@@ -18,7 +22,7 @@ static void glfwErrorCallback(int error, const char *description)
 }
 
 
-GLFWwindow* initialise()
+GLFWwindow* initialise(bool headless)
 {
     // Initialise GLFW
     if (!glfwInit())
@@ -39,6 +43,11 @@ GLFWwindow* initialise()
     glfwWindowHint(GLFW_RESIZABLE, c_windowResizable);
     glfwWindowHint(GLFW_SAMPLES, c_windowSamples);  // MSAA
 
+    // A hidden window still gives us a full context and default framebuffer,
+    // which is all we need for offscreen benchmarking (e.g. under xvfb-run)
+    if (headless)
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
     // Create window using GLFW
     GLFWwindow* window = glfwCreateWindow(c_windowWidth,
                                           c_windowHeight,
@@ -74,6 +83,16 @@ int main(int argc, const char* argb[])
     const auto& showHelp = parser.add<bool>("help", "Show this help message.", 'h', arrrgh::Optional, false);
     const auto& enableMusic = parser.add<bool>("enable-music", "Play background music while the game is playing", 'm', arrrgh::Optional, false);
     const auto& enableAutoplay = parser.add<bool>("autoplay", "Let the game play itself automatically. Useful for testing.", 'a', arrrgh::Optional, false);
+    const auto& headless = parser.add<bool>("headless", "Render to a hidden window. Useful together with --benchmark.", '\0', arrrgh::Optional, false);
+    const auto& benchmarkFrames = parser.add<int>("benchmark", "Render exactly N frames, then print frame time statistics and exit.", 'b', arrrgh::Optional, 0);
+    const auto& telemetryPath = parser.add<std::string>("telemetry", "Write per-frame timings and counters to this .csv or .json file.", 't', arrrgh::Optional, "");
+    const auto& microBenchmark = parser.add<std::string>("micro-benchmark", "Run the named micro-benchmark instead of the scene, e.g. 'uniforms'.", '\0', arrrgh::Optional, "");
+    const auto& grassCount = parser.add<int>("grass", "Scatter this many grass clones over the terrain.", '\0', arrrgh::Optional, 150);
+    const auto& threads = parser.add<int>("threads", "Threads for the job system and for the asset loader each, counting the main thread. 0 picks one per core.", 'j', arrrgh::Optional, 0);
+    const auto& oit = parser.add<bool>("oit", "Blend transparent geometry with weighted blended OIT instead of sorting it. Toggled with O.", '\0', arrrgh::Optional, false);
+    const auto& mdi = parser.add<bool>("mdi", "Submit draws with glMultiDrawElementsIndirect instead of one draw call per batch. Toggled with M.", '\0', arrrgh::Optional, false);
+    const auto& shaderCachePath = parser.add<std::string>("shader-cache", "Cache linked shader programs in this directory. Pass \"\" to always compile.", '\0', arrrgh::Optional, "shader_cache");
+    const auto& fixedTimeDelta = parser.add<float>("fixed-dt", "Step the scene by this many seconds each frame instead of using the wall clock.", '\0', arrrgh::Optional, 0.0f);
 
     // If you want to add more program arguments, define them here,
     // but do not request their value here (they have not been parsed yet at this point).
@@ -98,9 +117,27 @@ int main(int argc, const char* argb[])
     CommandLineOptions options;
     options.enableMusic = enableMusic.value();
     options.enableAutoplay = enableAutoplay.value();
+    options.headless = headless.value();
+    options.benchmarkFrames = benchmarkFrames.value();
+    options.fixedTimeDelta = fixedTimeDelta.value();
+    options.telemetryPath = telemetryPath.value();
+    options.microBenchmark = microBenchmark.value();
+    options.grassCount = std::max(0, grassCount.value());
+    options.threads = threads.value();
+    options.oit = oit.value();
+    options.mdi = mdi.value();
+    options.shaderCachePath = shaderCachePath.value();
+
+    // Benchmarks need reproducible scene states
+    if (options.benchmarkFrames > 0 && options.fixedTimeDelta <= 0)
+        options.fixedTimeDelta = 1.0f / 60.0f;
+
+    setJobSystemThreads(std::max(0, options.threads));
+    setAssetLoaderThreads(std::max(0, options.threads));
+    Gloom::setProgramCacheDirectory(options.shaderCachePath);
 
     // Initialise window using GLFW
-    GLFWwindow* window = initialise();
+    GLFWwindow* window = initialise(options.headless);
 
     // Run an OpenGL application using this window
     runProgram(window, options);
@@ -2,11 +2,15 @@
 #include "program.hpp"
 #include "utilities/window.hpp"
 #include "renderlogic.hpp"
+#include "benchmarks.hpp"
+#include "utilities/assetLoader.hpp"
+#include "utilities/shaderWatcher.hpp"
 #include <glm/glm.hpp>
 // glm::translate, glm::rotate, glm::scale, glm::perspective
 #include <glm/gtc/matrix_transform.hpp>
 #include <iostream>
 #include <iomanip>
+#include <vector>
 #include <SFML/Audio.hpp>
 #include <SFML/System/Time.hpp>
 #include <utilities/shapes.h>
@@ -14,12 +18,30 @@
 #include <utilities/shader.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <utilities/timeutils.hpp>
+#include <utilities/telemetry.hpp>
 
 using std::cout;
 using std::endl;
 using std::setprecision;
+using std::vector;
 
-void runProgram(GLFWwindow* window, CommandLineOptions options)
+static FrameRecord makeFrameRecord(uint64_t frame, double td, double tu, double tr)
+{
+    FrameRecord record;
+    record.frame           = frame;
+    record.dt              = td;
+    record.update_time     = tu;
+    record.render_time     = tr;
+    record.draw_calls      = render_stats.draw_calls;
+    record.uniform_uploads = render_stats.uniform_uploads;
+    record.triangles       = render_stats.triangles;
+    record.state_changes   = render_stats.state_changes;
+    record.visible_nodes   = render_stats.visible_nodes;
+    record.culled_nodes    = render_stats.culled_nodes;
+    return record;
+}
+
+static void initGLState()
 {
     // Enable depth (Z) buffer (accept "closest" fragment)
     glEnable(GL_DEPTH_TEST);
@@ -31,13 +53,101 @@ void runProgram(GLFWwindow* window, CommandLineOptions options)
     //enable alpha
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_BLEND);
+}
+
+// Renders exactly options.benchmarkFrames frames with a fixed timestep and
+// prints statistics for the update and render phases.
+static void runBenchmark(GLFWwindow* window, CommandLineOptions options)
+{
+    // don't let vsync dictate the frame times
+    glfwSwapInterval(0);
+
+    int w, h;
+    glfwGetWindowSize(window, &w, &h);
+
+    initRenderer(window, w, h);
+    Clock load_clock;
+    init_scene(options);
+    assetLoader().finish(); // measure the scene, not it popping in
+    printf("assets loaded in %.3f s\n", load_clock.getTimeDeltaSeconds());
+
+    const int frames = options.benchmarkFrames;
+    const double td = options.fixedTimeDelta;
+    vector<double> update_times, render_times, frame_times;
+    update_times.reserve(frames);
+    render_times.reserve(frames);
+    frame_times.reserve(frames);
+
+    FrameTelemetry telemetry;
+    if (!options.telemetryPath.empty()) telemetry.start(options.telemetryPath);
+
+    Clock prof;
+    for (int i = 0; i < frames && !glfwWindowShouldClose(window); i++)
+    {
+        prof.getTimeDeltaSeconds();
+
+        step_scene(td);
+        updateFrame(window, w, h);
+        double tu = prof.getTimeDeltaSeconds();
+
+        renderFrame(window, w, h);
+        glFinish(); // else we only measure how fast we can queue commands
+        double tr = prof.getTimeDeltaSeconds();
+
+        update_times.push_back(tu);
+        render_times.push_back(tr);
+        frame_times.push_back(tu + tr);
+        telemetry.push(makeFrameRecord(i, td, tu, tr));
+
+        glfwPollEvents();
+        glfwSwapBuffers(window);
+    }
+
+    printf("benchmark: %i frames, %ix%i, fixed dt %g s\n",
+        int(frame_times.size()), w, h, td);
+    printf("%-8s %10s %10s %10s %10s\n", "phase", "min ms", "median ms", "p99 ms", "mean ms");
+    auto print_row = [](const char* name, vector<double>& samples) {
+        TimingStats s = summarizeTimings(samples);
+        printf("%-8s %10.3f %10.3f %10.3f %10.3f\n",
+            name, s.min*1000, s.median*1000, s.p99*1000, s.mean*1000);
+    };
+    print_row("update", update_times);
+    print_row("render", render_times);
+    print_row("frame",  frame_times);
+    printf("last frame: %u draw calls, %u uniform uploads, %u triangles, %u state changes\n",
+        render_stats.draw_calls, render_stats.uniform_uploads, render_stats.triangles, render_stats.state_changes);
+    printf("last frame: %u meshes visible, %u culled\n",
+        render_stats.visible_nodes, render_stats.culled_nodes);
+}
+
+void runProgram(GLFWwindow* window, CommandLineOptions options)
+{
+    initGLState();
+    transparency_mode = options.oit ? WEIGHTED_BLENDED_OIT : SORTED_TRANSPARENCY;
+    submission_mode = options.mdi ? INDIRECT_SUBMISSION : DIRECT_SUBMISSION;
+
+    if (!options.microBenchmark.empty()) {
+        runMicroBenchmark(window, options.microBenchmark);
+        return;
+    }
+    if (options.benchmarkFrames > 0)
+        return runBenchmark(window, options);
 
     int w, h;
     glfwGetWindowSize(window, &w, &h);
     
     initRenderer(window, w, h);
+    Clock load_clock;
     init_scene(options);
+    bool loading = true;
     Clock c, prof;
+
+    FrameTelemetry telemetry;
+    telemetry.start(options.telemetryPath);
+    uint64_t frame = 0;
+
+    // rebuild shaders edited while running
+    shaderWatcher().start();
     
     // Rendering Loop
     while (!glfwWindowShouldClose(window))
@@ -45,13 +155,25 @@ void runProgram(GLFWwindow* window, CommandLineOptions options)
         glfwGetWindowSize(window, &w, &h);
         
         double td = c.getTimeDeltaSeconds();
-        step_scene(td);
-        
+        if (options.fixedTimeDelta > 0) td = options.fixedTimeDelta;
+
+        shaderWatcher().poll();
+
+        // upload and attach what the asset loader has ready, spending at
+        // most ~2 ms of the frame on it
+        assetLoader().pump(0.002);
+        if (loading && assetLoader().pending() == 0) {
+            printf("assets loaded in %.3f s\n", load_clock.getTimeDeltaSeconds());
+            loading = false;
+        }
+
         prof.getTimeDeltaSeconds();
+        step_scene(td);
         updateFrame(window, w, h);
-        cout << "uf: " << setprecision(4) << prof.getTimeDeltaSeconds() / td * 100 << "\t";
+        double tu = prof.getTimeDeltaSeconds();
         renderFrame(window, w, h);
-        cout << "rf: " << setprecision(4) << prof.getTimeDeltaSeconds() / td * 100 << endl << endl;
+        double tr = prof.getTimeDeltaSeconds();
+        telemetry.push(makeFrameRecord(frame++, td, tu, tr));
 
 
         // Handle other events
@@ -72,4 +194,22 @@ void handleKeyboardInput(GLFWwindow* window)
     {
         glfwSetWindowShouldClose(window, GL_TRUE);
     }
+
+    // toggle the transparency mode on O, once per press
+    static bool oit_key_down = false;
+    bool oit_key = glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS;
+    if (oit_key && !oit_key_down)
+        transparency_mode = (transparency_mode == SORTED_TRANSPARENCY)
+            ? WEIGHTED_BLENDED_OIT
+            : SORTED_TRANSPARENCY;
+    oit_key_down = oit_key;
+
+    // and the submission mode on M
+    static bool mdi_key_down = false;
+    bool mdi_key = glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS;
+    if (mdi_key && !mdi_key_down)
+        submission_mode = (submission_mode == DIRECT_SUBMISSION)
+            ? INDIRECT_SUBMISSION
+            : DIRECT_SUBMISSION;
+    mdi_key_down = mdi_key;
 }
@@ -0,0 +1,144 @@
+#include "renderQueue.hpp"
+#include <algorithm>
+#include <cstring>
+
+bool TextureSet::operator==(const TextureSet& other) const {
+    return memcmp(id, other.id, sizeof(id)) == 0;
+}
+
+// masks `value` to `bits` bits and moves it to `shift`
+static inline uint64_t field(uint64_t value, uint bits, uint shift) {
+    return (value & ((uint64_t(1) << bits) - 1)) << shift;
+}
+
+static inline uint64_t quantize(float x, uint bits) {
+    x = std::min(std::max(x, 0.0f), 1.0f);
+    return uint64_t(x * float((uint64_t(1) << bits) - 1));
+}
+
+void RenderQueue::clear() {
+    items.clear();
+    keys.clear();
+    hud_order = 0;
+    transparent_ids.clear();
+    transparent_keys.clear();
+    shaders.clear();
+    texture_sets.clear();
+    materials.clear();
+    texture_set_ids.clear();
+    material_ids.clear();
+}
+
+uint32_t RenderQueue::internShader(Gloom::Shader* shader) {
+    for (uint32_t i = 0; i < shaders.size(); i++)
+        if (shaders[i] == shader) return i;
+    shaders.push_back(shader);
+    return shaders.size() - 1;
+}
+
+void RenderQueue::push(RenderPass pass, const FlatScene& scene, uint index, Gloom::Shader* shader, float depth) {
+    const SceneNode* node = scene.node[index];
+
+    TextureSet textures = {{0, 0, 0, 0}};
+    if (node->isTextured)           textures.id[0] = node->diffuseTextureID;
+    if (node->isNormalMapped)       textures.id[1] = node->normalTextureID;
+    if (node->isDisplacementMapped) textures.id[2] = node->displacementTextureID;
+    if (node->isReflectionMapped)   textures.id[3] = node->reflectionTextureID;
+    auto t = texture_set_ids.emplace(textures, texture_sets.size());
+    if (t.second) texture_sets.push_back(textures);
+
+    MaterialBlock material = makeMaterialBlock(node);
+    auto m = material_ids.emplace(material, materials.size());
+    if (m.second) materials.push_back(material);
+
+    uint64_t shader_id   = internShader(shader);
+    uint64_t texture_set = t.first->second;
+    uint64_t material_id = m.first->second;
+    uint64_t mesh        = uint64_t(node->meshID);
+    uint64_t wide        = node->indexType == GL_UNSIGNED_INT;
+
+    uint64_t key = field(pass, 2, 62);
+    switch (pass) {
+    case PASS_OPAQUE:
+        key |= field(shader_id,   8, 54)
+            |  field(texture_set, 14, 40)
+            |  field(wide,         1, 39)
+            |  field(mesh,        13, 26)
+            |  field(material_id, 14, 12)
+            |  quantize(depth, 12);
+        break;
+    case PASS_TRANSPARENT:
+        if (sort_transparent) {
+            // keeps push order here, see sort()
+            transparent_ids.push_back(index);
+            transparent_keys.push_back(TransparencySorter::depthKey(depth, 1.0f));
+            break;
+        }
+        key |= field(shader_id,   8, 54)
+            |  field(texture_set, 14, 40)
+            |  field(wide,         1, 39)
+            |  field(mesh,        13, 26)
+            |  field(material_id, 14, 12);
+        break;
+    case PASS_HUD:
+        key |= field(hud_order++, 24, 38)
+            |  field(shader_id,   8, 30)
+            |  field(texture_set, 10, 20)
+            |  field(mesh,        10, 10)
+            |  field(material_id, 10, 0);
+        break;
+    }
+
+    items.push_back({&scene, index, node, shader, pass, uint32_t(texture_set), uint32_t(material_id)});
+    keys.push_back(key);
+}
+
+void RenderQueue::sort() {
+    order.resize(items.size());
+    for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+    radixSort(keys, order, keys_scratch, order_scratch);
+
+    // the transparent items are now contiguous and still in push order
+    size_t begin = std::lower_bound(keys.begin(), keys.end(), field(PASS_TRANSPARENT, 2, 62)) - keys.begin();
+    size_t n = transparent_ids.size();
+    if (n == 0) return;
+    const std::vector<uint32_t>& back_to_front = transparency_sorter.sort(transparent_ids.data(), transparent_keys.data(), n);
+    transparent_scratch.assign(order.begin() + begin, order.begin() + begin + n);
+    for (size_t i = 0; i < n; i++)
+        order[begin + i] = transparent_scratch[back_to_front[i]];
+}
+
+void radixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values,
+        std::vector<uint64_t>& keys_scratch, std::vector<uint32_t>& values_scratch,
+        uint key_bits) {
+    const size_t n = keys.size();
+    const uint n_bytes = (key_bits + 7) / 8;
+    if (n < 2) return;
+    keys_scratch.resize(n);
+    values_scratch.resize(n);
+
+    // the histograms of all bytes in a single pass over the keys
+    size_t counts[8][256] = {};
+    for (uint64_t key : keys)
+        for (uint b = 0; b < n_bytes; b++)
+            counts[b][(key >> (b*8)) & 0xff]++;
+
+    for (uint b = 0; b < n_bytes; b++) {
+        const uint shift = b * 8;
+        if (counts[b][(keys[0] >> shift) & 0xff] == n) continue; // all keys share this byte
+
+        size_t offsets[256];
+        size_t sum = 0;
+        for (uint i = 0; i < 256; i++) {
+            offsets[i] = sum;
+            sum += counts[b][i];
+        }
+        for (size_t i = 0; i < n; i++) {
+            size_t dst = offsets[(keys[i] >> shift) & 0xff]++;
+            keys_scratch[dst] = keys[i];
+            values_scratch[dst] = values[i];
+        }
+        keys.swap(keys_scratch);
+        values.swap(values_scratch);
+    }
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include "flatScene.hpp"
+#include "uniformBlocks.hpp"
+#include "transparencySorter.hpp"
+
+enum RenderPass { PASS_OPAQUE, PASS_TRANSPARENT, PASS_HUD };
+
+// The textures bound to units 0-3 by a draw, 0 where unused
+struct TextureSet {
+    uint32_t id[4];
+    bool operator==(const TextureSet& other) const;
+};
+
+// One instance of one draw
+struct RenderItem {
+    const FlatScene* scene; // supplies the transforms
+    uint index;             // of the node in `scene`
+    const SceneNode* node;  // supplies the mesh
+    Gloom::Shader* shader;
+    RenderPass pass;
+    uint32_t texture_set; // interned for this frame,
+    uint32_t material;    // see RenderQueue
+};
+
+// Collects a frame's draws and orders them by 64 bit sort keys, so executing
+// them in order binds as little state as possible and instances of the
+// same draw end up next to each other. The keys are laid out per pass as
+//   opaque:      pass:2 shader:8 textures:14 wide:1 mesh:13 material:14 depth:12
+//   transparent: pass:2, or pass:2 shader:8 textures:14 wide:1 mesh:13 material:14
+//   hud:         pass:2 order:24 shader:8 textures:10 mesh:10 material:10
+// with opaque geometry front to back within each state and the hud in
+// traversal order. `wide` is set for 32 bit indices, keeping meshes of either
+// index type together, as a multi-draw takes only one. Transparent geometry
+// is ordered back to front by a TransparencySorter, identifying draws across
+// frames by their node index, unless sort_transparent is off, in which case
+// it is ordered by state only.
+// Ids too large for their field only make the sort less effective, the
+// executor compares the full ids. Materials and texture sets are interned
+// anew every frame, as some materials are animated. Materials are read per
+// instance from a storage buffer, so they come after the mesh: instances of
+// a mesh differing only in material still end up in one draw.
+class RenderQueue {
+public:
+    void clear();
+
+    // `depth` is the view space distance, normalized to [0, 1]
+    void push(RenderPass pass, const FlatScene& scene, uint index, Gloom::Shader* shader, float depth);
+
+    // LSD radix sort of the keys
+    void sort();
+
+    size_t size() const { return items.size(); }
+
+    // in sorted order once sort() has been called
+    const RenderItem& operator[](size_t i) const { return items[order[i]]; }
+
+    const MaterialBlock& material(uint32_t id) const { return materials[id]; }
+    const std::vector<MaterialBlock>& allMaterials() const { return materials; }
+    const TextureSet& textureSet(uint32_t id) const { return texture_sets[id]; }
+
+    // off when transparent geometry is blended order independently. Set it
+    // before pushing a frame's draws
+    bool sort_transparent = true;
+
+private:
+    struct BytesHash {
+        template<typename T> size_t operator()(const T& value) const { // FNV-1a
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+            size_t hash = 14695981039346656037ull;
+            for (size_t i = 0; i < sizeof(T); i++)
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+            return hash;
+        }
+    };
+    struct BytesEqual {
+        template<typename T> bool operator()(const T& a, const T& b) const {
+            return memcmp(&a, &b, sizeof(T)) == 0;
+        }
+    };
+
+    uint32_t internShader(Gloom::Shader* shader);
+
+    std::vector<RenderItem> items;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> order;
+    std::vector<uint64_t> keys_scratch;
+    std::vector<uint32_t> order_scratch;
+    uint32_t hud_order = 0;
+
+    TransparencySorter transparency_sorter;
+    std::vector<uint32_t> transparent_ids;  // in push order
+    std::vector<uint32_t> transparent_keys;
+    std::vector<uint32_t> transparent_scratch;
+
+    std::vector<Gloom::Shader*> shaders;
+    std::vector<TextureSet> texture_sets;
+    std::vector<MaterialBlock> materials;
+    std::unordered_map<TextureSet, uint32_t, BytesHash, BytesEqual> texture_set_ids;
+    std::unordered_map<MaterialBlock, uint32_t, BytesHash, BytesEqual> material_ids;
+};
+
+// Stable LSD radix sort of `keys` on their lowest `key_bits` bits, a byte at
+// a time, permuting `values` along with them. Bytes shared by all keys are
+// skipped. The scratch vectors are resized as needed and may be swapped with
+// their counterparts, keep them around between calls.
+void radixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values,
+    std::vector<uint64_t>& keys_scratch, std::vector<uint32_t>& values_scratch,
+    uint key_bits = 64);
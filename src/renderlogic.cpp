@@ -1,5 +1,8 @@
 #include "renderlogic.hpp"
 #include "sceneGraph.hpp"
+#include "flatScene.hpp"
+#include "uniformBlocks.hpp"
+#include "renderQueue.hpp"
 #include <GLFW/glfw3.h>
 #include <SFML/Audio/Sound.hpp>
 #include <SFML/Audio/SoundBuffer.hpp>
@@ -10,10 +13,14 @@
 #include <iostream>
 #include <string>
 #include <algorithm>
+#include <cstddef>
+#include <cstring>
 #include <utilities/glutils.h>
 #include <utilities/shader.hpp>
 
 #include <utilities/timeutils.hpp>
+#include <utilities/jobSystem.hpp>
+#include <utilities/shaderWatcher.hpp>
 
 
 using glm::vec3;
@@ -26,19 +33,40 @@ typedef unsigned int uint;
 sf::Sound* sound;
 sf::SoundBuffer* buffer;
 
-// for keeping track of the currently loaded shader in renderNode()
+// for keeping track of the currently loaded shader in drawBatches()
 Gloom::Shader* current_shader = nullptr;
-Gloom::Shader* prev_shader = nullptr; // The last shader to glDrawElements
 
 // the framebuffer we render the scene to before post-processing
 GLuint framebufferID = 0;
 GLuint framebufferTextureID = 0;
 GLuint framebufferDepthBufferID = 0;
 GLuint framebufferDepthTextureID = 0;
+GLuint oitAccumTextureID = 0;  // attachment 1, premultiplied colour and alpha, weighted
+GLuint oitRevealTextureID = 0; // attachment 2, product of (1 - alpha)
+
+TransparencyMode transparency_mode = SORTED_TRANSPARENCY;
+SubmissionMode submission_mode = DIRECT_SUBMISSION;
+
+RenderStats render_stats;
+
+// the main camera's clipping planes
+const float c_zNear = 0.1f;
+const float c_zFar  = 5000.f;
+
+GLuint uniformBufferID = 0; // FrameBlock, uniform binding 0
+FrameBlock frame_block;
+
+// shader storage bindings 0 and 1, refilled every frame
+GLuint objectBufferID = 0;
+GLuint materialBufferID = 0;
+
+// this frame's DrawElementsIndirectCommands, with INDIRECT_SUBMISSION
+GLuint indirectBufferID = 0;
 
 // the surface we use for post-processing
 GLuint postVAO;
 Gloom::Shader* post_shader = nullptr;
+Gloom::Shader* oit_composite_shader = nullptr;
 
 void mouse_callback(GLFWwindow* window, double x, double y) {
     static bool mouse_mode = false;
@@ -97,6 +125,19 @@ void initRenderer(GLFWwindow* window, int windowWidth, int windowHeight) {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
 
+    // the weighted blended OIT targets, see resolveOIT()
+    if (first) glGenTextures(1, &oitAccumTextureID);
+    glBindTexture(GL_TEXTURE_2D, oitAccumTextureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, windowWidth, windowHeight, 0, GL_RGBA, GL_HALF_FLOAT, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    if (first) glGenTextures(1, &oitRevealTextureID);
+    glBindTexture(GL_TEXTURE_2D, oitRevealTextureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, windowWidth, windowHeight, 0, GL_RED, GL_UNSIGNED_BYTE, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
     if (first) glGenRenderbuffers(1, &framebufferDepthBufferID);
     glBindRenderbuffer(GL_RENDERBUFFER, framebufferDepthBufferID);
     glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, windowWidth, windowHeight);
@@ -105,8 +146,10 @@ void initRenderer(GLFWwindow* window, int windowWidth, int windowHeight) {
     // Set "framebufferTextureID" as our colour attachement #0
     glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, framebufferTextureID, 0);
     glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, framebufferDepthTextureID, 0);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, oitAccumTextureID, 0);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, oitRevealTextureID, 0);
 
-    // Set the list of draw buffers.
+    // Set the list of draw buffers, the OIT pass switches to its own
     GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0};
     glDrawBuffers(1, drawBuffers);
 
@@ -118,34 +161,75 @@ void initRenderer(GLFWwindow* window, int windowWidth, int windowHeight) {
     }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+    if (first) {
+        glGenBuffers(1, &uniformBufferID);
+        glBindBuffer(GL_UNIFORM_BUFFER, uniformBufferID);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameBlock), nullptr, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, 0, uniformBufferID);
+
+        glGenBuffers(1, &objectBufferID);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBufferID);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 1024 * sizeof(ObjectData), nullptr, GL_STREAM_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, objectBufferID);
+
+        glGenBuffers(1, &materialBufferID);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, materialBufferID);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 256 * sizeof(MaterialBlock), nullptr, GL_STREAM_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, materialBufferID);
+
+        glGenBuffers(1, &indirectBufferID);
+    }
+
     if (first) {
         postVAO = generatePostQuadBuffer();
         post_shader = new Gloom::Shader();
         post_shader->makeBasicShader("../res/shaders/post.vert", "../res/shaders/post.frag");
+        oit_composite_shader = new Gloom::Shader();
+        oit_composite_shader->makeBasicShader("../res/shaders/post.vert", "../res/shaders/oit_composite.frag");
+        shaderWatcher().watch(post_shader);
+        shaderWatcher().watch(oit_composite_shader);
     }
 
     first = false;
 }
 
-// traverses and updates matricies
-void updateNodeTransformations(SceneNode* node, mat4 transformationThusFar, mat4 const& V, mat4 const& P) {
-    mat4 M = (node->has_no_transforms())
-        ? transformationThusFar
-        : transformationThusFar
-        * glm::translate(mat4(1.0), node->position)
-        * glm::translate(mat4(1.0), node->referencePoint)
-        * glm::rotate(mat4(1.0), node->rotation.z, vec3(0,0,1))
-        * glm::rotate(mat4(1.0), node->rotation.y, vec3(0,1,0))
-        * glm::rotate(mat4(1.0), node->rotation.x, vec3(1,0,0))
-        * glm::scale(mat4(1.0), node->scale)
-        * glm::translate(mat4(1.0), -node->referencePoint);
-
-    node->MV = V*M;
-    node->MVP = P*node->MV;
-    node->MVnormal = glm::inverse(glm::transpose(node->MV));
-
-    for(SceneNode* child : node->children)
-        updateNodeTransformations(child, M, V, P);
+// The six planes of a view frustum, as (normal, distance) with the normals
+// pointing inwards, extracted from a view-projection matrix (Gribb/Hartmann)
+struct Frustum {
+    enum Result { OUTSIDE, INTERSECTING, INSIDE };
+    vec4 planes[6];
+
+    Frustum() = default;
+    explicit Frustum(const mat4& VP) {
+        mat4 rows = glm::transpose(VP);
+        for (int i = 0; i < 3; i++) {
+            planes[i*2 + 0] = rows[3] + rows[i];
+            planes[i*2 + 1] = rows[3] - rows[i];
+        }
+    }
+
+    Result test(vec3 lo, vec3 hi) const {
+        if (lo.x > hi.x) return OUTSIDE; // empty
+        Result result = INSIDE;
+        for (const vec4& plane : planes) {
+            vec3 n = vec3(plane);
+            // the corners furthest along and against the plane normal
+            vec3 far  = vec3(n.x >= 0 ? hi.x : lo.x, n.y >= 0 ? hi.y : lo.y, n.z >= 0 ? hi.z : lo.z);
+            vec3 near = vec3(n.x >= 0 ? lo.x : hi.x, n.y >= 0 ? lo.y : hi.y, n.z >= 0 ? lo.z : hi.z);
+            if (glm::dot(n, far)  + plane.w < 0) return OUTSIDE;
+            if (glm::dot(n, near) + plane.w < 0) result = INTERSECTING;
+        }
+        return result;
+    }
+};
+static Frustum view_frustum; // of the main camera, in world space
+
+// flattened copies of rootNode and hudNode, baked on first use
+static FlatScene scene_flat, hud_flat;
+
+void invalidateBakedScene() {
+    scene_flat = FlatScene();
+    hud_flat = FlatScene();
 }
 
 // step
@@ -156,14 +240,19 @@ void updateFrame(GLFWwindow* window, int windowWidth, int windowHeight) {
     mat4 projection = glm::perspective(
         glm::radians(45.0f), // fovy
         aspect, // aspect
-        0.1f, 5000.f // near, far
+        c_zNear, c_zFar
     );
 
     mat4 cameraTransform
         = glm::lookAt(cameraPosition, cameraLookAt, cameraUpward);
 
+    if (scene_flat.size() == 0 || scene_flat.node[0] != rootNode) bakeScene(rootNode, scene_flat);
+    if (hud_flat.size()   == 0 || hud_flat.node[0]   != hudNode)  bakeScene(hudNode, hud_flat);
+
     // update scene with camera
-    updateNodeTransformations(rootNode, mat4(1.0), cameraTransform, projection);
+    updateTransforms(scene_flat, cameraTransform, projection, jobSystem());
+    frame_block.P = projection;
+    view_frustum = Frustum(projection * cameraTransform);
 
     // We orthographic now, bitches!
     // set orthographic VP for hud
@@ -171,151 +260,282 @@ void updateFrame(GLFWwindow* window, int windowWidth, int windowHeight) {
     projection = glm::ortho(-aspect, aspect, -1.0f, 1.0f);
 
     // update hud
-    updateNodeTransformations(hudNode, mat4(1.0), cameraTransform, projection);
+    updateTransforms(hud_flat, cameraTransform, projection);
+
+    // lights and their targets are expected to be part of rootNode
+    auto baked = [](const SceneNode* node) {
+        return node->flat_index >= 0
+            && size_t(node->flat_index) < scene_flat.size()
+            && scene_flat.node[node->flat_index] == node;
+    };
 
     // update spots
     for (SceneNode* node : lightNode) {
-        if (node->nodeType == SPOT_LIGHT && node->spot_target) {
+        if (node->nodeType == SPOT_LIGHT && node->spot_target && baked(node) && baked(node->spot_target)) {
             node->spot_direction = glm::normalize(
-                vec3(node->spot_target->MV * vec4(0,0,0,1))
-                - vec3(node->MV * vec4(0,0,0,1)));
+                vec3(scene_flat.MV[node->spot_target->flat_index] * vec4(0,0,0,1))
+                - vec3(scene_flat.MV[node->flat_index] * vec4(0,0,0,1)));
         }
     }
 
+    // hidden nodes used to end the traversal, leaving their lights as they were
+    auto hidden = [](const SceneNode* node) {
+        for (int i = node->flat_index; i >= 0; i = scene_flat.parent[i])
+            if (scene_flat.node[i]->isHidden) return true;
+        return false;
+    };
+
+    // update lights
+    for (SceneNode* node : lightNode) {
+        LightBlock& light = frame_block.light[node->lightID];
+        if (!baked(node)) {
+            light.color = vec3(0.0);
+            continue;
+        }
+        if (hidden(node)) continue;
+        const mat4& MV       = scene_flat.MV[node->flat_index];
+        const mat4& MVnormal = scene_flat.MVnormal[node->flat_index];
+        light.position          = vec3(MV * vec4(vec3(0.0), 1.0));
+        light.is_spot           = node->nodeType == SPOT_LIGHT;
+        light.spot_direction    = (node->transform_spot)
+            ? node->spot_direction                              // MV space
+            : vec3(MVnormal * vec4(node->spot_direction, 1.0)); // Model space
+        light.spot_cuttof_cos   = node->spot_cuttof_cos;
+        light.attenuation       = node->attenuation;
+        light.color             = node->light_color;
+    }
 }
 
-// traverses and renders one and one node
-struct NodeDistShader{
-    SceneNode* node;
-    Gloom::Shader* s;
-    float dist;
-    NodeDistShader(SceneNode* node, Gloom::Shader* s, float dist)
-        : node(node), s(s), dist(dist) {}
+// A run of instances in `objects` sharing all state, drawn with one
+// glDrawElementsInstancedBaseVertexBaseInstance, or one command of a
+// glMultiDrawElementsIndirect
+struct Batch {
+    const RenderItem* item; // the first instance
+    uint first_instance;
+    uint instance_count;
+};
+
+// as read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint  baseVertex;
+    GLuint baseInstance;
 };
-void renderNode(SceneNode* node, Gloom::Shader* parent_shader, vector<NodeDistShader>* transparent_nodes=nullptr, bool do_recursive=true) {
-    struct Light { // lights as stored in the shader
-        // coordinates in MV space
-        vec3  position; // MV
-        vec3  attenuation;
-        vec3  color;
-
-        bool  is_spot;
-        vec3  spot_direction; // MV, must be normalized
-        float spot_cuttof_cos;
-
-        void push_to_shader(Gloom::Shader* shader, uint id) {
-            #define L(x) shader->location("light[" + std::to_string(id) + "]." #x)
-            #define V(x) glUniform3fv(L(x), 1, glm::value_ptr(x))
-                glUniform1i (L(is_spot)          , is_spot);
-                glUniform1f (L(spot_cuttof_cos), spot_cuttof_cos);
-                V(position);
-                V(spot_direction);
-                V(attenuation);
-                V(color);
-            #undef V
-            #undef L
+
+// this frame's instances, uploaded to objectBufferID in one go
+static vector<ObjectData> objects;
+
+static RenderQueue render_queue;
+
+// Sweeps a baked scene, pushing its visible geometry onto render_queue. The
+// hud goes in PASS_HUD, everything else in PASS_OPAQUE or PASS_TRANSPARENT.
+// Subtrees outside `frustum` are skipped, and once a subtree is known to be
+// fully inside, its descendants are not tested further. The hud passes nullptr.
+void collectNodes(const FlatScene& scene, bool hud, const Frustum* frustum) {
+    uint inside_until = 0; // nodes before this are known to be inside the frustum
+    for (uint i = 0; i < scene.size();) {
+        const SceneNode* node = scene.node[i];
+        if (node->isHidden) {
+            i = scene.subtree_end[i];
+            continue;
         }
-    };
-    static Light lights[N_LIGHTS];
 
-    if (node->isHidden) return;
+        if (frustum && i >= inside_until) {
+            Frustum::Result result = frustum->test(scene.bounds_min[i], scene.bounds_max[i]);
+            if (result == Frustum::OUTSIDE) {
+                render_stats.culled_nodes += scene.subtree_geometry[i];
+                i = scene.subtree_end[i];
+                continue;
+            }
+            if (result == Frustum::INSIDE) inside_until = scene.subtree_end[i];
+        }
 
-    // activate the correct shader
-    Gloom::Shader* s = (node->shader != nullptr)
-        ? node->shader
-        : parent_shader;
-    if (current_shader != s) {
-        current_shader = s;
+        if (node->nodeType == GEOMETRY
+                && node->vertexArrayObjectID != -1
+                && node->opacity > 0.05) {
+            render_stats.visible_nodes++;
+            RenderPass pass = hud ? PASS_HUD
+                : node->has_transparancy() ? PASS_TRANSPARENT
+                : PASS_OPAQUE;
+            float depth = -scene.MV[i][3].z / c_zFar; // view space
+            Gloom::Shader* shader = scene.shader[i]->get(node->shaderFeatures());
+            render_queue.push(pass, scene, i, shader, depth);
+        }
+        i++;
+    }
+}
+
+// Groups consecutive items of the sorted queue sharing all state, and lays
+// out their instances in `objects`
+static void buildBatches(vector<Batch>& batches) {
+    for (size_t k = 0; k < render_queue.size(); k++) {
+        const RenderItem& item = render_queue[k];
+        const RenderItem* prev = batches.empty() ? nullptr : batches.back().item;
+        if (prev
+                && prev->pass        == item.pass
+                && prev->shader      == item.shader
+                && prev->texture_set == item.texture_set
+                && prev->node->vertexArrayObjectID == item.node->vertexArrayObjectID
+                && prev->node->indexType           == item.node->indexType
+                && prev->node->firstIndex          == item.node->firstIndex
+                && prev->node->baseVertex          == item.node->baseVertex
+                && prev->node->VAOIndexCount       == item.node->VAOIndexCount)
+            batches.back().instance_count++;
+        else
+            batches.push_back({&item, uint(objects.size()), 1});
+
+        const FlatScene& scene = *item.scene;
+        objects.push_back({scene.MVP[item.index], scene.MV[item.index], scene.MVnormal[item.index], item.material, {}});
+    }
+}
+
+// bound state, invalidated every frame since the post pass binds its own
+static GLuint bound_textures[4];
+static GLint  bound_vao;
+
+static void invalidateBindings() {
+    current_shader = nullptr;
+    bound_vao = -1;
+    for (GLuint& id : bound_textures) id = 0;
+}
+
+// Redirects the transparent pass into the OIT attachments: colour weighted
+// by alpha and depth is summed in accum, and the (1 - alpha) of all layers
+// multiplied in reveal, both independent of the order of the fragments
+static void beginOIT() {
+    const GLenum buffers[] = {GL_NONE, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
+    glDrawBuffers(3, buffers);
+    const GLfloat accum_clear[]  = {0, 0, 0, 0};
+    const GLfloat reveal_clear[] = {1, 0, 0, 0};
+    glClearBufferfv(GL_COLOR, 1, accum_clear);
+    glClearBufferfv(GL_COLOR, 2, reveal_clear);
+    glBlendFunci(1, GL_ONE, GL_ONE);
+    glBlendFunci(2, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+}
+
+// Blends the averaged transparent colour over attachment 0 by the coverage
+// left in reveal, and restores the state beginOIT() changed
+static void resolveOIT() {
+    const GLenum buffers[] = {GL_COLOR_ATTACHMENT0};
+    glDrawBuffers(1, buffers);
+    glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+    glDisable(GL_DEPTH_TEST);
+
+    current_shader = oit_composite_shader;
+    current_shader->activate();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, oitAccumTextureID);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, oitRevealTextureID);
+    bound_textures[0] = oitAccumTextureID;
+    bound_textures[1] = oitRevealTextureID;
+    bound_vao = postVAO;
+    glBindVertexArray(postVAO);
+    glDrawElements(GL_TRIANGLES, 6 /*vertices*/, GL_UNSIGNED_INT, nullptr);
+    render_stats.draw_calls++;
+    render_stats.triangles += 2;
+    render_stats.state_changes += 4;
+
+    glEnable(GL_DEPTH_TEST);
+    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+// the passes come in order, with depth writes only in the opaque one
+static void changePass(RenderPass from, RenderPass to) {
+    if (from == PASS_OPAQUE)
+        glDepthMask(GL_FALSE); // read only
+    if (transparency_mode == WEIGHTED_BLENDED_OIT) {
+        if (to   == PASS_TRANSPARENT) beginOIT();
+        if (from == PASS_TRANSPARENT) resolveOIT();
+    }
+}
+
+// binds state only where it differs from the previous batch
+static void bindState(const RenderItem& item) {
+    if (current_shader != item.shader) {
+        current_shader = item.shader;
         current_shader->activate();
-        uint i = 0; for (Light l : lights) l.push_to_shader(s, i++);
+        render_stats.state_changes++;
     }
 
-    bool shader_changed = current_shader != prev_shader;
-    #define init_cache(x) static decltype(node->x) cached_##x;
-    #define if_cache(x) if (shader_changed || cached_##x != node->x) { cached_##x = node->x;
-    #define cache(x) init_cache(x) if_cache(x)
-    #define um4fv(x) cache(x) glUniformMatrix4fv(s->location(#x), 1, GL_FALSE, glm::value_ptr(node->x)); }
-    #define u2fv(x)  cache(x) glUniform2fv( s->location(#x), 1, glm::value_ptr(node->x)); }
-    #define u3fv(x)  cache(x) glUniform3fv( s->location(#x), 1, glm::value_ptr(node->x)); }
-    #define u1f(x)   cache(x) glUniform1f(  s->location(#x), node->x); }
-    #define u1ui(x)  cache(x) glUniform1ui( s->location(#x), node->x); }
-    //#define ubtu(n,i,x) init_cache(x) if(node->i) { if_cache(x) glBindTextureUnit(n, node->x); } } else cached_##x = -1;
-    #define ubtu(n,i,x) init_cache(x) if(node->i) { if_cache(x) glActiveTexture(GL_TEXTURE0+n); glBindTexture(GL_TEXTURE_2D, node->x); } } else cached_##x = -1;
-
-    switch(node->nodeType) {
-        case GEOMETRY:
-            if (transparent_nodes!=nullptr && node->has_transparancy()) {
-                // defer to sorted pass later on
-                transparent_nodes->emplace_back(node, s, glm::length(vec3(node->MVP*vec4(0,0,0,1))));
-            }
-            else if(node->vertexArrayObjectID != -1) {
-                if (node->opacity <= 0.05) break;
-                
-                // load scene uniforms
-                if (shader_changed) { // guaranteed at start of every frame, due to post_shader
-                    glUniform3fv(s->location("fog_color"), 1, glm::value_ptr(fog_color));
-                    glUniform1f( s->location("fog_strength"), fog_strength);
-                }
-                
-                // load material uniforms
-                um4fv(MVP);
-                um4fv(MV);
-                um4fv(MVnormal);
-                u2fv (uvOffset);
-                u3fv (diffuse_color);
-                u3fv (emissive_color);
-                u3fv (specular_color);
-                u3fv (backlight_color);
-                u1f  (opacity);
-                u1f  (shininess);
-                u1f  (backlight_strength);
-                u1f  (reflexiveness);
-                u1f  (displacementCoefficient);
-                u1ui (isTextured);
-                u1ui (isVertexColored);
-                u1ui (isNormalMapped);
-                u1ui (isDisplacementMapped);
-                u1ui (isReflectionMapped);
-                u1ui (isIlluminated);
-                u1ui (isInverted);
-                ubtu(0, isTextured          , diffuseTextureID);
-                ubtu(1, isNormalMapped      , normalTextureID);
-                ubtu(2, isDisplacementMapped, displacementTextureID);
-                ubtu(3, isReflectionMapped  , reflectionTextureID);
-                glBindVertexArray(node->vertexArrayObjectID);
-                glDrawElements(GL_TRIANGLES, node->VAOIndexCount, GL_UNSIGNED_INT, nullptr);
-                prev_shader = current_shader;
-            }
-            break;
-        case SPOT_LIGHT:
-        case POINT_LIGHT: {
-            uint id = node->lightID;
-            lights[id].position          = vec3(node->MV * vec4(vec3(0.0), 1.0));
-            lights[id].is_spot           = node->nodeType == SPOT_LIGHT;
-            lights[id].spot_direction    = (node->transform_spot)
-                ? node->spot_direction                                   // MV space
-                : vec3(node->MVnormal * vec4(node->spot_direction, 1.0));// Model space
-            lights[id].spot_cuttof_cos   = node->spot_cuttof_cos;
-            lights[id].attenuation       = node->attenuation;
-            lights[id].color             = node->light_color;
-            lights[id].push_to_shader(s, id);
-            break;
-        }
-        default:
-            break;
+    const TextureSet& textures = render_queue.textureSet(item.texture_set);
+    for (uint unit = 0; unit < 4; unit++) {
+        if (textures.id[unit] == 0 || bound_textures[unit] == textures.id[unit]) continue;
+        bound_textures[unit] = textures.id[unit];
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, textures.id[unit]);
+        //glBindTextureUnit(unit, textures.id[unit]);
+        render_stats.state_changes++;
+    }
+
+    const SceneNode* node = item.node;
+    if (bound_vao != node->vertexArrayObjectID) {
+        bound_vao = node->vertexArrayObjectID;
+        glBindVertexArray(node->vertexArrayObjectID);
+        render_stats.state_changes++;
     }
+}
 
-    #undef um4fv
-    #undef u2fv
-    #undef u3fv
-    #undef u1f
-    #undef u1ui
-    #undef ubtu
-    #undef cache
-
-    if (do_recursive)
-    for(SceneNode* child : node->children)
-        renderNode(child, s, transparent_nodes, true);
+// whether b can go in the same glMultiDrawElementsIndirect as a, which
+// takes a single index type
+static bool sameBindings(const RenderItem& a, const RenderItem& b) {
+    return a.pass        == b.pass
+        && a.shader      == b.shader
+        && a.texture_set == b.texture_set
+        && a.node->vertexArrayObjectID == b.node->vertexArrayObjectID
+        && a.node->indexType           == b.node->indexType;
+}
+
+// Writes a command per batch into indirectBufferID, in the order of `batches`
+static void uploadIndirectCommands(const vector<Batch>& batches) {
+    static vector<DrawElementsIndirectCommand> commands;
+    commands.clear();
+    for (const Batch& batch : batches) {
+        const SceneNode* node = batch.item->node;
+        commands.push_back({node->VAOIndexCount, batch.instance_count,
+            node->firstIndex, node->baseVertex, batch.first_instance});
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBufferID);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand),
+        commands.data(), GL_STREAM_DRAW);
+    // not counted in uniform_uploads, which should be comparable with and without MDI
+}
+
+static void drawBatches(const vector<Batch>& batches) {
+    const bool indirect = submission_mode == INDIRECT_SUBMISSION;
+    if (indirect) uploadIndirectCommands(batches);
+
+    RenderPass pass = PASS_OPAQUE;
+    for (size_t i = 0; i < batches.size();) {
+        const RenderItem& item = *batches[i].item;
+        if (pass != item.pass)
+            changePass(pass, item.pass);
+        pass = item.pass;
+        bindState(item);
+
+        // the run of batches [i, end) drawn by this call
+        size_t end = i + 1;
+        if (indirect)
+            while (end < batches.size() && sameBindings(item, *batches[end].item)) end++;
+
+        if (indirect) {
+            glMultiDrawElementsIndirect(GL_TRIANGLES, item.node->indexType,
+                (void*)(i * sizeof(DrawElementsIndirectCommand)), GLsizei(end - i), 0);
+        } else {
+            const SceneNode* node = item.node;
+            glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, node->VAOIndexCount, node->indexType,
+                (void*)(size_t(node->firstIndex) * indexSize(node->indexType)),
+                batches[i].instance_count, node->baseVertex, batches[i].first_instance);
+        }
+        render_stats.draw_calls++;
+        for (; i < end; i++)
+            render_stats.triangles += batches[i].item->node->VAOIndexCount / 3 * batches[i].instance_count;
+    }
+    if (pass == PASS_TRANSPARENT && transparency_mode == WEIGHTED_BLENDED_OIT)
+        resolveOIT();
+    glDepthMask(GL_TRUE); // read write
 }
 
 // draw
@@ -329,7 +549,43 @@ void renderFrame(GLFWwindow* window, int windowWidth, int windowHeight) {
         cout << "reinit renderer" << endl;
         initRenderer(window, old_windowWidth, windowHeight);
     }
-    
+    render_stats = RenderStats();
+    invalidateBindings();
+
+    // load scene uniforms
+    frame_block.fog_color    = fog_color;
+    frame_block.fog_strength = fog_strength;
+    frame_block.time         = scene_time;
+    glBindBuffer(GL_UNIFORM_BUFFER, uniformBufferID);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame_block), &frame_block);
+    render_stats.uniform_uploads++;
+
+    // gather and sort this frame's draws
+    render_queue.clear();
+    render_queue.sort_transparent = transparency_mode == SORTED_TRANSPARENCY;
+    collectNodes(scene_flat, false, &view_frustum);
+    collectNodes(hud_flat, true, nullptr);
+    render_queue.sort();
+
+    static vector<Batch> batches;
+    batches.clear();
+    objects.clear();
+    buildBatches(batches);
+
+    // upload all instances at once
+    reserveInstanceIndices(objects.size());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBufferID);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, objects.size() * sizeof(ObjectData), objects.data(), GL_STREAM_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, objectBufferID);
+    render_stats.uniform_uploads++;
+
+    // and the materials they index
+    const vector<MaterialBlock>& materials = render_queue.allMaterials();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, materialBufferID);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, materials.size() * sizeof(MaterialBlock), materials.data(), GL_STREAM_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, materialBufferID);
+    render_stats.uniform_uploads++;
+
     // render to internal buffer
     glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
     glViewport(0, 0, windowWidth, windowHeight);
@@ -337,23 +593,7 @@ void renderFrame(GLFWwindow* window, int windowWidth, int windowHeight) {
     // Clear colour and depth buffers
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    static vector<NodeDistShader> transparent_nodes;
-    transparent_nodes.clear();
-    renderNode(rootNode, nullptr, &transparent_nodes); // rootNode defined in scene.hpp
-
-    // sort and render transparent node, sorted by distance from camera
-    std::sort(
-        transparent_nodes.begin(),
-        transparent_nodes.end(),
-        [](NodeDistShader a, NodeDistShader b) {
-            return a.dist > b.dist;
-    });
-    glDepthMask(GL_FALSE); // read only
-    for (NodeDistShader a : transparent_nodes)
-        renderNode(a.node, a.s, nullptr, false);
-    renderNode(hudNode, nullptr); // rootNode defined in scene.hpp
-    glDepthMask(GL_TRUE); // read write
-
+    drawBatches(batches);
   
     // render framebuffer to window
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -362,12 +602,10 @@ void renderFrame(GLFWwindow* window, int windowWidth, int windowHeight) {
     current_shader = post_shader;
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     
-    static Clock c;
-    static float t = 0.0;
-    t += c.getTimeDeltaSeconds();
-    glUniform1f(post_shader->location("time"), t);
-    glUniform1ui(post_shader->location("windowWidth"), windowWidth);
-    glUniform1ui(post_shader->location("windowHeight"), windowHeight);
+    glUniform1f(post_shader->location(UNIFORM("time")), scene_time);
+    glUniform1ui(post_shader->location(UNIFORM("windowWidth")), windowWidth);
+    glUniform1ui(post_shader->location(UNIFORM("windowHeight")), windowHeight);
+    render_stats.uniform_uploads += 3;
     //glBindTextureUnit(0, framebufferTextureID);
     //glBindTextureUnit(1, framebufferDepthTextureID);
     glActiveTexture(GL_TEXTURE0);
@@ -376,6 +614,7 @@ void renderFrame(GLFWwindow* window, int windowWidth, int windowHeight) {
     glBindTexture(GL_TEXTURE_2D, framebufferDepthTextureID);
     glBindVertexArray(postVAO);
     glDrawElements(GL_TRIANGLES, 6 /*vertices*/, GL_UNSIGNED_INT, nullptr);
-    prev_shader = post_shader;
+    render_stats.draw_calls++;
+    render_stats.triangles += 2;
     
 }
@@ -7,6 +7,36 @@
 // further divied into:
 #include "scene.hpp"
 
+// per-frame counters, reset at the start of every renderFrame()
+struct RenderStats {
+    uint draw_calls      = 0;
+    uint uniform_uploads = 0;
+    uint triangles       = 0;
+    uint state_changes   = 0; // shader, texture and VAO binds
+    uint visible_nodes   = 0; // meshes that passed frustum culling
+    uint culled_nodes    = 0; // meshes skipped by frustum culling
+};
+extern RenderStats render_stats;
+
+// How PASS_TRANSPARENT is blended. Sorted blends back to front and is exact,
+// weighted blended OIT accumulates in any order into two extra attachments
+// and composites them, which needs no sort and lets transparent instances
+// batch, at the cost of only approximating the order where layers overlap.
+enum TransparencyMode { SORTED_TRANSPARENCY, WEIGHTED_BLENDED_OIT };
+extern TransparencyMode transparency_mode; // may be changed between frames
+
+// How batches are submitted. Direct issues one instanced draw per batch,
+// indirect writes a DrawElementsIndirectCommand per batch into a buffer and
+// issues one glMultiDrawElementsIndirect per run of batches sharing pass,
+// shader and textures, as the per-draw data is all fetched from the
+// object and material storage buffers.
+enum SubmissionMode { DIRECT_SUBMISSION, INDIRECT_SUBMISSION };
+extern SubmissionMode submission_mode; // may be changed between frames
+
 void initRenderer(GLFWwindow* window,int windowWidth, int windowHeight);
 void updateFrame(GLFWwindow* window, int windowWidth, int windowHeight);
 void renderFrame(GLFWwindow* window, int windowWidth, int windowHeight);
+
+// rootNode and hudNode are flattened on the first updateFrame(), call this
+// after changing the structure of the scene graph to have them baked again
+void invalidateBakedScene();
@@ -8,10 +8,16 @@
 #include <glad/glad.h>
 #include <iostream>
 #include <cstdlib>
+#include <functional>
+#include <map>
+#include <memory>
+#include <utilities/assetLoader.hpp>
+#include <utilities/bakedModel.hpp>
 #include <utilities/imageLoader.hpp>
 #include <utilities/modelLoader.hpp>
 #include <utilities/mesh.h>
 #include <utilities/shader.hpp>
+#include <utilities/shaderWatcher.hpp>
 #include <utilities/shapes.h>
 #include <utilities/timeutils.hpp>
 #include <utilities/glfont.h>
@@ -33,7 +39,8 @@ vec3 cameraUpward = vec3(0, 0, 1);
 vec3  fog_color = vec3(1.0);
 float fog_strength = 0;
 
-const size_t N_GRASS = 150;
+double scene_time = 0; // accumulated step_scene time deltas
+
 const size_t N_TREES = 30;
 const size_t DISPLACEMENT = 30;
 const vec2 plane_movement = {0.5, 0.1};
@@ -52,36 +59,87 @@ SceneNode* textNode;
 
 vector<SceneNode*> movingNodes;
 
-Gloom::Shader* default_shader;
+Gloom::ShaderPermutations* default_shader;
 //Gloom::Shader* plain_shader;
 
 // todo: const the following:
 
-// meshes
-Mesh m_box = generateBox(50, 50, 50);
-Mesh m_sphere = generateSphere(10, 100, 100);
-Mesh m_plain = generateSegmentedPlane(1000, 1000, 100, 100, 3);
-Mesh m_hello_world = generateTextGeometryBuffer("Skjer'a bagera?", 1.3, 2);
+// meshes and textures, filled in by the asset loader, see init_scene()
+Mesh m_box;
+Mesh m_sphere;
+Mesh m_plain;
+Mesh m_hello_world;
+
+PNGImage t_charmap;
+PNGImage t_cobble_diff;
+PNGImage t_cobble_normal;
+PNGImage t_plain_diff;
+PNGImage t_plain_normal;
+PNGImage t_reflection;
+PNGImage t_perlin;
 
-// textures
-PNGImage t_charmap       = loadPNGFile("../res/textures/charmap.png");
-PNGImage t_cobble_diff   = loadPNGFile("../res/textures/cobble_diff.png");
-PNGImage t_cobble_normal = loadPNGFile("../res/textures/cobble_normal.png");
-PNGImage t_plain_diff    = loadPNGFile("../res/textures/plain_diff.png");
-PNGImage t_plain_normal  = loadPNGFile("../res/textures/plain_normal.png", true);
-PNGImage t_reflection    = loadPNGFile("../res/textures/reflection_field.png");
-PNGImage t_perlin        = makePerlinNoisePNG(256, 256, 0.05/16);
+// for loads depending on others
+static JobSystem::Counter perlin_loaded, reflection_loaded, plain_loaded;
+static bool perlin_ready = false; // on the render thread, t_perlin may be sampled
+
+// Where a scattered tree or straw of grass goes. Drawn from rand() up front,
+// so the scene is the same whatever order the models finish loading in.
+struct Scatter { float x, y, rotation_z, scale_z; };
+static vector<Scatter> scatter(size_t count) {
+    vector<Scatter> out(count);
+    for (Scatter& s : out) {
+        s.x = (rand() % 10000) / 10;
+        s.y = (rand() % 10000) / 10;
+        s.rotation_z = (rand() % 31415) / 10000;
+        s.scale_z = 0.8 + (rand()%100)/250;
+    }
+    return out;
+}
+
+// Places clones of `model` on the plain, scrolling along with it
+static void scatterClones(const SceneNode* model, const vector<Scatter>& places) {
+    for (const Scatter& s : places) {
+        SceneNode* node = model->clone();
+        node->position.x = s.x;
+        node->position.y = s.y;
+        node->position.z = DISPLACEMENT * (t_perlin.at_bilinear(node->position.x*3/1000, node->position.y*3/1000).x * 2 - 1) - 0.5;
+        //node->position.z = DISPLACEMENT * (t_perlin.at_nearest(node->position.x*3/1000, node->position.y*3/1000).x * 2 - 1) - 0.5;
+        node->rotation.z = s.rotation_z;
+        node->scale.z *= s.scale_z;
+        rootNode->children.push_back(node);
+        movingNodes.push_back(node);
+    }
+}
+
+// Imports the scene.gltf in `dirname` on the loader threads, once `after`
+// is done, and hands it to `place` on the render thread
+static void loadModel(
+        const std::string& dirname,
+        const std::map<int, Material>& overrides,
+        std::function<void(SceneNode*)> place,
+        JobSystem::Counter* after = nullptr) {
+    auto baked = std::make_shared<std::shared_ptr<BakedModel>>();
+    assetLoader().load(
+        [=]() {
+            *baked = prepareModel(dirname, "scene.gltf", &assetLoader().pool());
+            if (after) assetLoader().wait(*after);
+        },
+        [=]() {
+            place(buildModelScene(**baked, dirname, overrides));
+            baked->reset();
+            invalidateBakedScene();
+        });
+}
 
 void init_scene(CommandLineOptions options) {
-    default_shader = new Gloom::Shader();
-    default_shader->makeBasicShader("../res/shaders/simple.vert", "../res/shaders/simple.frag");
+    default_shader = new Gloom::ShaderPermutations(
+        "../res/shaders/simple.vert", "../res/shaders/simple.frag", shaderFeatureDefines());
+    shaderWatcher().watch(default_shader);
     
     rootNode = createSceneNode();
     hudNode = createSceneNode();
     rootNode->shader = default_shader;
     hudNode->shader = default_shader;
-
-    t_perlin.repeat_mirrored = true; // no const for me ;(
     
     // create and add lights to graph
     for (uint i = 0; i<N_LIGHTS; i++) {
@@ -89,39 +147,59 @@ void init_scene(CommandLineOptions options) {
         lightNode[i]->lightID = i;
     }
     
-    SceneNode* treeModel = loadModelScene("../res/models/fur_tree", "scene.gltf");
-    treeModel->setMaterial(Material().emissive(vec3(0.2)).emissive_only().no_texture_reset(), true);
-    treeModel->scale *= 0.8;
-    treeModel->scale.z *= 0.8;
-    for (uint i = N_TREES; i--;) {
-        SceneNode* tree = treeModel->clone();
-        tree->position.x = (rand() % 10000) / 10;
-        tree->position.y = (rand() % 10000) / 10;
-        tree->position.z = DISPLACEMENT * (t_perlin.at_bilinear(tree->position.x*3/1000, tree->position.y*3/1000).x * 2 - 1) - 0.5;
-        //node->position.z = DISPLACEMENT * (t_perlin.at_nearest(node->position.x*3/1000, node->position.y*3/1000).x * 2 - 1) - 0.5;
-        tree->rotation.z = (rand() % 31415) / 10000;
-        tree->scale.z *= 0.8 + (rand()%100)/250;
-        rootNode->children.push_back(tree);
-        movingNodes.push_back(tree);
-    }
+    // Meshes and textures are decoded, imported and generated on the loader
+    // threads, and hooked into the nodes below as they finish. The first
+    // frame renders whatever is ready, which is next to nothing.
+    AssetLoader& loader = assetLoader();
+    loader.load([]() {
+        t_perlin = makePerlinNoisePNG(256, 256, 0.05/16);
+        t_perlin.repeat_mirrored = true; // no const for me ;(
+    }, []() { perlin_ready = true; }, &perlin_loaded);
+    loader.load([]() { t_reflection   = loadPNGFile("../res/textures/reflection_field.png", false, COMPRESS_COLOR, &assetLoader().pool()); }, {}, &reflection_loaded);
+    loader.load([]() { t_plain_diff   = loadPNGFile("../res/textures/plain_diff.png", false, COMPRESS_COLOR, &assetLoader().pool()); }, {}, &plain_loaded);
+    loader.load([]() { t_plain_normal = loadPNGFile("../res/textures/plain_normal.png", true, COMPRESS_NORMALS, &assetLoader().pool()); }, {}, &plain_loaded);
+    loader.load([]() { m_plain = generateSegmentedPlane(1000, 1000, 100, 100, 3); }, {}, &plain_loaded);
+    loader.load([]() {
+        t_charmap = loadPNGFile("../res/textures/charmap.png");
+        m_hello_world = generateTextGeometryBuffer("Skjer'a bagera?", 1.3, 2);
+    }, []() {
+        textNode->setTexture(&t_charmap);
+        textNode->setMesh(&m_hello_world);
+        invalidateBakedScene();
+    });
+    loader.load([]() { // unused for now, see boxNode and sphereNode below
+        t_cobble_diff   = loadPNGFile("../res/textures/cobble_diff.png");
+        t_cobble_normal = loadPNGFile("../res/textures/cobble_normal.png");
+        m_box = generateBox(50, 50, 50);
+        m_sphere = generateSphere(10, 100, 100);
+    });
     
-    SceneNode* grassModel = loadModelScene("../res/models/single_grass", "scene.gltf");
-    grassModel->setMaterial(Material().emissive(vec3(0.2)).emissive_only().no_texture_reset(), true);
-    grassModel->scale *= 1.3;
-    grassModel->scale.z *= 0.4;
-    for (uint i = N_GRASS; i--;) {
-        SceneNode* grass = grassModel->clone();
-        grass->position.x = (rand() % 10000) / 10;
-        grass->position.y = (rand() % 10000) / 10;
-        grass->position.z = DISPLACEMENT * (t_perlin.at_bilinear(grass->position.x*3/1000, grass->position.y*3/1000).x * 2 - 1) - 0.5;
-        grass->rotation.z = (rand() % 31415) / 10000;
-        grass->scale.z *= 0.8 + (rand()%100)/250;
-        rootNode->children.push_back(grass);
-        movingNodes.push_back(grass);
-    }
+    const vector<Scatter> trees = scatter(N_TREES);
+    loadModel("../res/models/fur_tree", {}, [trees](SceneNode* treeModel) {
+        treeModel->setMaterial(Material().emissive(vec3(0.2)).emissive_only().no_texture_reset(), true);
+        treeModel->scale *= 0.8;
+        treeModel->scale.z *= 0.8;
+        scatterClones(treeModel, trees);
+    }, &perlin_loaded);
+    
+    const vector<Scatter> grass = scatter(options.grassCount);
+    loadModel("../res/models/single_grass", {}, [grass](SceneNode* grassModel) {
+        grassModel->setMaterial(Material().emissive(vec3(0.2)).emissive_only().no_texture_reset(), true);
+        grassModel->scale *= 1.3;
+        grassModel->scale.z *= 0.4;
+        scatterClones(grassModel, grass);
+    }, &perlin_loaded);
     //treeNode
     
-    carNode = loadModelScene("../res/models/beetle", "scene.gltf", {
+    // the lights are attached to carNode right away, the model joins them
+    // once loaded
+    carNode = createSceneNode();
+    carNode->position = {522, 130, 0};
+    carNode->referencePoint = {0, -1, 0};
+    carNode->scale *= 28;
+    carNode->rotation.z = -glm::acos(1/glm::sqrt(5*5 + 1*1));
+    rootNode->children.push_back(carNode);
+    loadModel("../res/models/beetle", {
         { 0, Material().diffuse({0.0, 0.0, 1.0}).diffuse_only().reflection_mapped(&t_reflection, 0.15)},// Blue_Metal
         { 1, Material().diffuse(vec3(0.85)).emissive(vec3(0.1)).reflection_mapped(&t_reflection, -1.0)},// Metal (decals)
         //{ 2, Material().diffuse({1.0, 1.0, 1.0})},// Front_Light_Glass
@@ -136,22 +214,30 @@ void init_scene(CommandLineOptions options) {
         {11, Material().no_colors().reflection_mapped(&t_reflection, 1.0)},// License_Plate_Metal
         //{12, Material().diffuse({1.0, 1.0, 1.0})},// License_Plate_Frame
         //{13, Material().diffuse({1.0, 1.0, 1.0})},// 
-        });
-    carNode->setMaterial(Material().backlight(vec3(0.3), 0.3).backlight_only().no_texture_reset(), true);
-    carNode->position = {522, 130, 0};
-    carNode->referencePoint = {0, -1, 0};
-    carNode->scale *= 28;
-    carNode->rotation.z = -glm::acos(1/glm::sqrt(5*5 + 1*1));
-    rootNode->children.push_back(carNode);
+        }, [](SceneNode* carModel) {
+        carModel->setMaterial(Material().backlight(vec3(0.3), 0.3).backlight_only().no_texture_reset(), true);
+        // step_scene() drives the position and rotation of carNode, only the
+        // scale of the model's root matters
+        carNode->scale *= carModel->scale;
+        carNode->children.insert(carNode->children.end(),
+            carModel->children.begin(), carModel->children.end());
+        delete carModel;
+    }, &reflection_loaded);
     
     //create the scene:
     plainNode = createSceneNode();
     plainNode->setMaterial(Material().specular(vec3(0.15), 3));
-    plainNode->setTexture(&t_plain_diff, &t_plain_normal, &t_perlin);
-    plainNode->setMesh(&m_plain);
     plainNode->position = {0, 0, 0};
     plainNode->displacementCoefficient = DISPLACEMENT;
     rootNode->children.push_back(plainNode);
+    loader.load([]() {
+        assetLoader().wait(plain_loaded);
+        assetLoader().wait(perlin_loaded);
+    }, []() {
+        plainNode->setTexture(&t_plain_diff, &t_plain_normal, &t_perlin);
+        plainNode->setMesh(&m_plain);
+        invalidateBakedScene();
+    });
     
     /*
     boxNode = createSceneNode();
@@ -229,8 +315,6 @@ void init_scene(CommandLineOptions options) {
     
     // HUD
     textNode = createSceneNode();
-    textNode->setTexture(&t_charmap);
-    textNode->setMesh(&m_hello_world);
     textNode->position = vec3(-1.0, -1.0, 0.0);
     textNode->isIlluminated = false;
     textNode->isInverted = true;
@@ -245,10 +329,8 @@ bool mouse_position_handler(double mx, double my, int scale) {
 }
 
 void step_scene(double timeDelta) {
-    static double timeAcc = 0; // shrug
-    timeAcc += timeDelta;
-    
-    cout << "td: " << timeDelta << " " << 1/timeDelta << endl;
+    scene_time += timeDelta;
+    const double timeAcc = scene_time;
     
     if (boxNode) boxNode->rotation.z += timeDelta;
     
@@ -310,8 +392,8 @@ void step_scene(double timeDelta) {
         
         
     }
-    // car rotation
-    {
+    // car rotation, following the terrain once there is one
+    if (perlin_ready) {
         vec3 o = carNode->position;
         o.x += plainNode->uvOffset.x*1000/3;
         o.y += plainNode->uvOffset.y*1000/3;
@@ -12,6 +12,8 @@ extern SceneNode* lightNode[N_LIGHTS];
 extern vec3  fog_color;
 extern float fog_strength;
 
+extern double scene_time;
+
 extern glm::vec3 cameraPosition;
 extern glm::vec3 cameraLookAt;
 extern glm::vec3 cameraUpward;
@@ -6,15 +6,30 @@ SceneNode::SceneNode(SceneNodeType type) {
 }
 
 void SceneNode::setMesh(const Mesh* mesh) {
-	static map<const Mesh*, int> cache;
+	static map<const Mesh*, MeshRange> cache;
 
 	if (cache.find(mesh) == cache.end())
-		cache[mesh] = generateBuffer(*mesh, isNormalMapped || isDisplacementMapped);
+		cache[mesh] = meshArena().add(*mesh, isNormalMapped || isDisplacementMapped);
 
-	vertexArrayObjectID = cache[mesh];
-	VAOIndexCount = mesh->indices.size();
-	isVertexColored = ! mesh->colors.empty();
-	mesh_has_transparancy = mesh->has_transparancy;
+	vec3 mesh_min = vec3( INFINITY);
+	vec3 mesh_max = vec3(-INFINITY);
+	for (const vec3& v : mesh->vertices) {
+		mesh_min = glm::min(mesh_min, v);
+		mesh_max = glm::max(mesh_max, v);
+	}
+	setMesh(cache[mesh], mesh_min, mesh_max, !mesh->colors.empty(), mesh->has_transparancy);
+}
+void SceneNode::setMesh(const MeshRange& range, vec3 mesh_min, vec3 mesh_max, bool vertex_colored, bool transparent) {
+	vertexArrayObjectID = range.vao;
+	VAOIndexCount = range.indexCount;
+	indexType = range.indexType;
+	firstIndex = range.firstIndex;
+	baseVertex = range.baseVertex;
+	meshID = range.id;
+	aabb_min = mesh_min;
+	aabb_max = mesh_max;
+	isVertexColored = vertex_colored;
+	mesh_has_transparancy = transparent;
 }
 void SceneNode::setTexture(
 		const PNGImage* diffuse,
@@ -28,7 +43,7 @@ void SceneNode::setTexture(
 		isNormalMapped = false;
 		isDisplacementMapped = false;
 		isReflectionMapped = false;
-		tex_has_transparancy = false;
+		tex_alpha_mode = ALPHA_OPAQUE;
 	}
 
 	if (diffuse) {
@@ -36,7 +51,7 @@ void SceneNode::setTexture(
 			cache[diffuse] = generateTexture(*diffuse);
 		diffuseTextureID = cache[diffuse];
 		isTextured = true;
-		tex_has_transparancy = diffuse->has_transparancy;
+		tex_alpha_mode = diffuse->alpha_mode;
 	}
 	
 	if (normal) {
@@ -87,13 +102,47 @@ bool SceneNode::has_no_transforms() const {
 
 bool SceneNode::has_transparancy() const {
 	return mesh_has_transparancy
-		|| tex_has_transparancy
+		|| tex_alpha_mode == ALPHA_TRANSLUCENT
 		|| opacity < 0.98;
 }
 
+bool SceneNode::has_alpha_cutout() const {
+	return isTextured
+		&& tex_alpha_mode == ALPHA_MASKED
+		&& !has_transparancy();
+}
+
+const vector<std::string>& shaderFeatureDefines() {
+	static const vector<std::string> defines = {
+		"TEXTURED",
+		"VERTEX_COLORED",
+		"NORMAL_MAPPED",
+		"DISPLACEMENT_MAPPED",
+		"REFLECTION_MAPPED",
+		"ILLUMINATED",
+		"INVERTED",
+		"ALPHA_TESTED",
+	};
+	return defines;
+}
+
+uint32_t SceneNode::shaderFeatures() const {
+	uint32_t features = 0;
+	if (isTextured)           features |= FEATURE_TEXTURED;
+	if (isVertexColored)      features |= FEATURE_VERTEX_COLORED;
+	if (isNormalMapped)       features |= FEATURE_NORMAL_MAPPED;
+	if (isDisplacementMapped) features |= FEATURE_DISPLACEMENT_MAPPED;
+	if (isReflectionMapped)   features |= FEATURE_REFLECTION_MAPPED;
+	if (isIlluminated)        features |= FEATURE_ILLUMINATED;
+	if (isInverted)           features |= FEATURE_INVERTED;
+	if (has_alpha_cutout())   features |= FEATURE_ALPHA_TESTED;
+	return features;
+}
+
 SceneNode* SceneNode::clone() const {
 	SceneNode* out = new SceneNode();
 	*out = *this;
+	out->flat_index = -1; // not baked yet
 	out->children.clear();
 	for (SceneNode* child : children) {
 		out->children.push_back(child->clone());
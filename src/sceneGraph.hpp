@@ -2,6 +2,7 @@
 
 #include <assert.h>
 #include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
@@ -13,7 +14,9 @@
 #include <stack>
 #include <stdbool.h>
 #include <utilities/glutils.h>
+#include <utilities/meshArena.hpp>
 #include <utilities/shader.hpp>
+#include <utilities/shaderPermutations.hpp>
 #include <utilities/material.hpp>
 #include <vector>
 
@@ -31,10 +34,26 @@ enum SceneNodeType {
 	SPOT_LIGHT,
 };
 
+// The shader flags of a node as a mask of shader permutation features,
+// bit i enabling shaderFeatureDefines()[i]
+enum ShaderFeature : uint32_t {
+	FEATURE_TEXTURED            = 1 << 0,
+	FEATURE_VERTEX_COLORED      = 1 << 1,
+	FEATURE_NORMAL_MAPPED       = 1 << 2,
+	FEATURE_DISPLACEMENT_MAPPED = 1 << 3,
+	FEATURE_REFLECTION_MAPPED   = 1 << 4,
+	FEATURE_ILLUMINATED         = 1 << 5,
+	FEATURE_INVERTED            = 1 << 6,
+	FEATURE_ALPHA_TESTED        = 1 << 7,
+};
+const vector<std::string>& shaderFeatureDefines();
+
 struct SceneNode {
 	SceneNode(SceneNodeType type = GEOMETRY);
 	
 	void setMesh(const Mesh* mesh);
+	// for a mesh already in the arena, with its bounds in model space
+	void setMesh(const MeshRange& range, vec3 mesh_min, vec3 mesh_max, bool vertex_colored, bool transparent);
 	void setTexture(
 				const PNGImage* diffuse,
 				const PNGImage* normal=nullptr,
@@ -44,6 +63,8 @@ struct SceneNode {
 	void setMaterial(const Material& mat, bool recursive=false);
 	bool has_no_transforms() const;
 	bool has_transparancy() const;
+	bool has_alpha_cutout() const; // drawn opaque, alpha tested against alpha_cutoff
+	uint32_t shaderFeatures() const; // of the shader flags below
 	SceneNode* clone() const;
 	
 	// this node
@@ -68,6 +89,12 @@ struct SceneNode {
 	// VAO IDs refering to a loaded Mesh and its length
 	int vertexArrayObjectID = -1;
 	uint VAOIndexCount = 0;
+	uint indexType = GL_UNSIGNED_INT;
+	uint firstIndex = 0; // where the mesh is in the VAO's buffers,
+	int baseVertex = 0;  // see MeshRange
+	int meshID = -1;
+	vec3 aabb_min = vec3( INFINITY); // bounds of the mesh in model space,
+	vec3 aabb_max = vec3(-INFINITY); // empty (min > max) without one
 
 	// textures and materials
 	float opacity = 1.0;
@@ -87,7 +114,8 @@ struct SceneNode {
 	
 	// has_transparancy check
 	bool mesh_has_transparancy = false;
-	bool tex_has_transparancy = false;
+	AlphaMode tex_alpha_mode = ALPHA_OPAQUE; // of the diffuse texture
+	float alpha_cutoff = 0.5; // for masked diffuse textures
 	
 	// shader flags
 	bool isTextured = false;
@@ -100,10 +128,8 @@ struct SceneNode {
 
 	// rendering
 	bool isHidden = false;
-	Gloom::Shader* shader = nullptr;
-	mat4 MVP; // MVP
-	mat4 MV; // MV
-	mat4 MVnormal; // transpose(inverse(MV))
+	Gloom::ShaderPermutations* shader = nullptr; // the variant is picked by shaderFeatures()
+	int flat_index = -1; // into the FlatScene it was last baked into
 
 };
 
@@ -0,0 +1,86 @@
+#include "transparencySorter.hpp"
+#include "renderQueue.hpp"
+#include <algorithm>
+
+uint32_t TransparencySorter::depthKey(float depth, float far) {
+    double x = std::min(std::max(double(depth) / far, 0.0), 1.0);
+    return uint32_t(x * 4294967295.0);
+}
+
+const std::vector<uint32_t>& TransparencySorter::sort(const uint32_t* ids, const uint32_t* keys, size_t n) {
+    bool try_coherent = temporal_coherence && frames_until_retry == 0 && !prev_ids.empty();
+    if (frames_until_retry) frames_until_retry--;
+
+    if (try_coherent && sortCoherent(ids, keys, n)) {
+        last_path = COHERENT;
+    } else {
+        // don't pay for failed fixups every frame while the scene is in flux
+        if (try_coherent) frames_until_retry = 16;
+        sortRadix(keys, n);
+        last_path = RADIX;
+    }
+
+    prev_ids.resize(n);
+    for (size_t i = 0; i < n; i++)
+        prev_ids[i] = ids[order[i]];
+    return order;
+}
+
+bool TransparencySorter::sortCoherent(const uint32_t* ids, const uint32_t* keys, size_t n) {
+    if (n == 0) return false;
+
+    uint32_t max_id = *std::max_element(ids, ids + n);
+    if (slot_of_id.size() <= max_id) slot_of_id.resize(max_id + 1, -1);
+    for (size_t i = 0; i < n; i++)
+        slot_of_id[ids[i]] = int32_t(i);
+
+    // last frame's order for the draws still present, then the new ones,
+    // as (key, ~index) pairs so the fixup compares without indirection. The
+    // index is inverted so that, sorting descending, equal keys keep
+    // ascending indices, as in sortRadix()
+    packed.clear();
+    for (uint32_t id : prev_ids) {
+        if (id < slot_of_id.size() && slot_of_id[id] >= 0) {
+            uint32_t i = slot_of_id[id];
+            packed.push_back(uint64_t(keys[i]) << 32 | ~uint32_t(i));
+            slot_of_id[id] = -1;
+        }
+    }
+    size_t kept = packed.size();
+    for (size_t i = 0; i < n; i++) {
+        if (slot_of_id[ids[i]] >= 0) {
+            packed.push_back(uint64_t(keys[i]) << 32 | ~uint32_t(i));
+            slot_of_id[ids[i]] = -1;
+        }
+    }
+    if (n - kept > n / 8) return false; // too much changed
+
+    // insertion sort, furthest first, giving up if it turns quadratic
+    size_t budget = 4 * n + 64;
+    for (size_t i = 1; i < n; i++) {
+        uint64_t item = packed[i];
+        size_t j = i;
+        for (; j > 0 && packed[j-1] < item; j--)
+            packed[j] = packed[j-1];
+        packed[j] = item;
+        size_t moves = i - j;
+        if (moves > budget) return false;
+        budget -= moves;
+    }
+
+    order.resize(n);
+    for (size_t i = 0; i < n; i++)
+        order[i] = ~uint32_t(packed[i]);
+    return true;
+}
+
+void TransparencySorter::sortRadix(const uint32_t* keys, size_t n) {
+    // inverted, as radixSort sorts ascending
+    radix_keys.resize(n);
+    order.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        radix_keys[i] = ~keys[i];
+        order[i] = i;
+    }
+    radixSort(radix_keys, order, radix_keys_scratch, order_scratch, 32);
+}
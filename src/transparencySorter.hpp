@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Orders transparent draws back to front by quantised view space depth.
+// Camera and objects move little between frames, so the order of the last
+// frame is kept and fixed up with an insertion sort, which is close to
+// linear when only a few neighbours swap places. When too many draws came
+// or went, or the fixup does too much work, it falls back to an LSD radix
+// sort of the depth keys for a while.
+class TransparencySorter {
+public:
+    enum Path { RADIX, COHERENT };
+
+    // Quantises a view space depth in [0, far] to a sort key
+    static uint32_t depthKey(float depth, float far);
+
+    // Sorts draw 0..n-1, where ids[i] identifies draw i across frames and
+    // keys[i] is its depthKey(). Returns the draws furthest first.
+    const std::vector<uint32_t>& sort(const uint32_t* ids, const uint32_t* keys, size_t n);
+
+    bool temporal_coherence = true;
+    Path last_path = RADIX; // for benchmarks
+
+private:
+    bool sortCoherent(const uint32_t* ids, const uint32_t* keys, size_t n);
+    void sortRadix(const uint32_t* keys, size_t n);
+
+    std::vector<uint32_t> order;    // the result, indices into this frame's draws
+    std::vector<uint32_t> prev_ids; // last frame's result, as ids
+    std::vector<int32_t> slot_of_id; // id -> index into this frame's draws, or -1
+    std::vector<uint64_t> packed; // (key, index) pairs for the fixup
+    unsigned frames_until_retry = 0; // of the coherent path, after it failed
+    std::vector<uint64_t> radix_keys, radix_keys_scratch;
+    std::vector<uint32_t> order_scratch;
+};
@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+#include <glm/glm.hpp>
+#include "sceneGraph.hpp"
+#include "scene.hpp"
+
+// Blocks shared by simple.vert and simple.frag. FrameBlock is a std140
+// uniform block, the materials and objects std430 storage buffers, matching
+// the blocks in the shaders. MaterialBlock is laid out the same under both.
+// The material flags are not part of them, they select a shader variant,
+// see SceneNode::shaderFeatures().
+struct LightBlock { // coordinates in MV space
+    vec3  position;
+    float spot_cuttof_cos;
+    vec3  attenuation; // 1 / (x + y*l + z*l*l)
+    uint  is_spot;
+    vec3  color;
+    float _pad0;
+    vec3  spot_direction; // must be normalized
+    float _pad1;
+};
+struct FrameBlock {
+    LightBlock light[N_LIGHTS];
+    mat4  P;
+    vec3  fog_color;
+    float fog_strength;
+    float time;
+    float _pad[3]; // std140 rounds the block up to a multiple of 16
+};
+struct MaterialBlock {
+    vec3  diffuse_color;
+    float opacity;
+    vec3  specular_color;
+    float shininess;
+    vec3  emissive_color;
+    float reflexiveness;
+    vec3  backlight_color;
+    float backlight_strength;
+    vec2  uvOffset;
+    float displacementCoefficient;
+    float alphaCutoff; // with FEATURE_ALPHA_TESTED, fragments below it are discarded
+};
+
+// Per-instance data, read by the shaders from a std430 storage buffer indexed
+// by the per-instance vertex attribute set up by reserveInstanceIndices()
+struct ObjectData {
+    mat4 MVP;
+    mat4 MV;
+    mat4 MVnormal;
+    uint32_t material; // index into this frame's materials
+    uint32_t _pad[3];
+};
+static_assert(sizeof(LightBlock) == 64, "std140 layout mismatch");
+static_assert(offsetof(FrameBlock, P) == 64*N_LIGHTS, "std140 layout mismatch");
+static_assert(offsetof(FrameBlock, time) == 64*N_LIGHTS + 80, "std140 layout mismatch");
+static_assert(sizeof(FrameBlock) % 16 == 0, "std140 layout mismatch");
+static_assert(offsetof(MaterialBlock, uvOffset) == 64, "std140 layout mismatch");
+static_assert(offsetof(MaterialBlock, alphaCutoff) == 76, "std140 layout mismatch");
+static_assert(sizeof(MaterialBlock) == 80, "std140 layout mismatch");
+static_assert(sizeof(ObjectData) == 208, "std430 layout mismatch");
+
+inline MaterialBlock makeMaterialBlock(const SceneNode* node) {
+    MaterialBlock material;
+    material.diffuse_color           = node->diffuse_color;
+    material.opacity                 = node->opacity;
+    material.specular_color          = node->specular_color;
+    material.shininess               = node->shininess;
+    material.emissive_color          = node->emissive_color;
+    material.reflexiveness           = node->reflexiveness;
+    material.backlight_color         = node->backlight_color;
+    material.backlight_strength      = node->backlight_strength;
+    material.uvOffset                = node->uvOffset;
+    material.displacementCoefficient = node->displacementCoefficient;
+    material.alphaCutoff             = node->alpha_cutoff;
+    return material;
+}
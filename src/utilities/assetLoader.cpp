@@ -0,0 +1,63 @@
+#include "assetLoader.hpp"
+#include <chrono>
+#include <cmath>
+
+AssetLoader::AssetLoader(unsigned threads) : jobs(threads) {}
+
+void AssetLoader::load(std::function<void()> work, std::function<void()> ready, JobSystem::Counter* group) {
+	in_flight++;
+	auto job = [this, work = std::move(work), ready = std::move(ready), group]() {
+		work();
+		{
+			std::lock_guard<std::mutex> lock(ready_mutex);
+			ready_queue.push_back(ready ? ready : []{});
+		}
+		if (group) group->pending--;
+	};
+	if (group) group->pending++;
+
+	if (jobs.threadCount() == 1) job();
+	else jobs.run(all, std::move(job));
+}
+
+void AssetLoader::wait(JobSystem::Counter& group) {
+	jobs.wait(group);
+}
+
+unsigned AssetLoader::pump(double budget) {
+	using clock = std::chrono::steady_clock;
+	const auto start = clock::now();
+	unsigned count = 0;
+	while (true) {
+		std::function<void()> ready;
+		{
+			std::lock_guard<std::mutex> lock(ready_mutex);
+			if (ready_queue.empty()) break;
+			ready = std::move(ready_queue.front());
+			ready_queue.pop_front();
+		}
+		ready();
+		in_flight--;
+		count++;
+		if (std::chrono::duration<double>(clock::now() - start).count() >= budget) break;
+	}
+	return count;
+}
+
+void AssetLoader::finish() {
+	while (in_flight) {
+		jobs.wait(all);
+		pump(INFINITY);
+	}
+}
+
+static unsigned default_threads = 0;
+
+void setAssetLoaderThreads(unsigned threads) {
+	default_threads = threads;
+}
+
+AssetLoader& assetLoader() {
+	static AssetLoader loader(default_threads);
+	return loader;
+}
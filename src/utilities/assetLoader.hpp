@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include "jobSystem.hpp"
+
+// Loads assets off the render thread. Each load is split in two: `work`,
+// which decodes, imports or generates on a pool of loader threads, and
+// `ready`, which uploads the result and hooks it into the scene on the
+// render thread. The render thread calls pump() once a frame, which runs
+// the ready halves in the order their work finished, within a time budget.
+// The loader threads have their own JobSystem, as the render thread waiting
+// on jobSystem() would otherwise pick up an import and stall the frame.
+class AssetLoader {
+public:
+	// `threads` as for JobSystem, counting the render thread, which only
+	// lends a hand in wait() and finish(). 0 means one thread per core.
+	explicit AssetLoader(unsigned threads = 0);
+
+	// Runs `work` on a loader thread and then `ready`, if any, in pump().
+	// `group`, if given, counts the work of this load until it is done, for
+	// later loads to wait() on. Without loader threads, `work` runs here.
+	void load(std::function<void()> work, std::function<void()> ready = {}, JobSystem::Counter* group = nullptr);
+
+	// For work that depends on the work of other loads, from inside `work`
+	void wait(JobSystem::Counter& group);
+
+	// Runs ready halves until `budget` seconds have passed, at least one if
+	// any are queued. Returns how many ran.
+	unsigned pump(double budget);
+
+	// Blocks until every load so far is done, running its ready half
+	void finish();
+
+	// The loader threads, for `work` to spread itself over
+	JobSystem& pool() { return jobs; }
+
+	// Loads whose ready half has not run yet
+	size_t pending() const { return in_flight.load(); }
+
+private:
+	JobSystem jobs;
+	JobSystem::Counter all;
+	std::mutex ready_mutex;
+	std::deque<std::function<void()>> ready_queue;
+	std::atomic<size_t> in_flight{0};
+};
+
+// The loader used by the scene, created on first use
+AssetLoader& assetLoader();
+
+// Only has an effect before the first call to assetLoader(), 0 means one
+// thread per core
+void setAssetLoaderThreads(unsigned threads);
@@ -0,0 +1,220 @@
+#include "bakedModel.hpp"
+#include <glad/glad.h>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+typedef unsigned int uint;
+
+static size_t align16(size_t x) {
+    return (x + 15) & ~size_t(15);
+}
+
+// the size and modification time of `source`, zero if it is missing
+static void stamp(const std::string& source, uint64_t& size, int64_t& mtime) {
+    std::error_code error;
+    size = fs::file_size(source, error);
+    if (error) size = 0;
+    auto time = fs::last_write_time(source, error);
+    mtime = error ? 0 : int64_t(time.time_since_epoch().count());
+}
+
+void BakedModelWriter::addMaterial(const BakedMaterial& material, const std::string texture_paths[4]) {
+    BakedMaterial out = material;
+    for (uint i = 0; i < 4; i++) {
+        out.texture[i] = kNoTexture;
+        if (texture_paths[i].empty()) continue;
+        out.texture[i] = uint32_t(strings.size());
+        strings.append(texture_paths[i]);
+        strings.push_back('\0');
+    }
+    materials.push_back(out);
+}
+
+void BakedModelWriter::addMesh(const Mesh& mesh) {
+    std::vector<PackedVertex> vertices = packVertices(mesh);
+    const uint type = indexType(mesh);
+    std::vector<uint8_t> indices = packIndices(mesh, type);
+
+    BakedMesh out = {};
+    out.vertex_count = uint32_t(vertices.size());
+    out.index_count  = uint32_t(mesh.indices.size());
+    out.index_type   = type;
+    out.flags = 0;
+    if (!mesh.colors.empty())  out.flags |= BAKED_VERTEX_COLORED;
+    if (mesh.has_transparancy) out.flags |= BAKED_TRANSPARENT;
+    out.aabb_min = glm::vec3( INFINITY);
+    out.aabb_max = glm::vec3(-INFINITY);
+    for (const glm::vec3& v : mesh.vertices) {
+        out.aabb_min = glm::min(out.aabb_min, v);
+        out.aabb_max = glm::max(out.aabb_max, v);
+    }
+
+    auto append = [&](const void* data, size_t bytes) {
+        size_t offset = blobs.size();
+        blobs.resize(align16(offset + bytes));
+        if (bytes) memcpy(blobs.data() + offset, data, bytes);
+        return offset;
+    };
+    out.vertices = append(vertices.data(), vertices.size() * sizeof(PackedVertex));
+    out.indices  = append(indices.data(), indices.size());
+    meshes.push_back(out);
+}
+
+int32_t BakedModelWriter::addNode(const BakedNode& node) {
+    nodes.push_back(node);
+    return int32_t(nodes.size() - 1);
+}
+
+std::vector<uint8_t> BakedModelWriter::finish(const std::string& source) const {
+    BakedHeader header = {};
+    memcpy(header.magic, "TDTB", 4);
+    header.version     = kBakedModelVersion;
+    stamp(source, header.source_size, header.source_mtime);
+    header.n_materials = uint32_t(materials.size());
+    header.n_meshes    = uint32_t(meshes.size());
+    header.n_nodes     = uint32_t(nodes.size());
+    header.materials   = align16(sizeof(BakedHeader));
+    header.meshes      = align16(header.materials + materials.size() * sizeof(BakedMaterial));
+    header.nodes       = align16(header.meshes    + meshes.size()    * sizeof(BakedMesh));
+    header.strings     = align16(header.nodes     + nodes.size()     * sizeof(BakedNode));
+    const size_t blobs_offset = align16(header.strings + strings.size());
+    header.file_size   = blobs_offset + blobs.size();
+
+    std::vector<uint8_t> file(header.file_size, 0);
+    memcpy(file.data(), &header, sizeof(header));
+    memcpy(file.data() + header.materials, materials.data(), materials.size() * sizeof(BakedMaterial));
+    BakedMesh* out_meshes = reinterpret_cast<BakedMesh*>(file.data() + header.meshes);
+    for (size_t i = 0; i < meshes.size(); i++) {
+        out_meshes[i] = meshes[i];
+        out_meshes[i].vertices += blobs_offset;
+        out_meshes[i].indices  += blobs_offset;
+    }
+    memcpy(file.data() + header.nodes, nodes.data(), nodes.size() * sizeof(BakedNode));
+    memcpy(file.data() + header.strings, strings.data(), strings.size());
+    memcpy(file.data() + blobs_offset, blobs.data(), blobs.size());
+    return file;
+}
+
+bool BakedModel::open(const std::string& path, const std::string& source) {
+    close();
+#ifdef __unix__
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            mapping = p;
+            data = static_cast<const uint8_t*>(p);
+            size = st.st_size;
+        }
+    }
+    ::close(fd);
+    if (!mapping) return false;
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    data = buffer.data();
+    size = buffer.size();
+#endif
+    if (valid(source)) return true;
+    close();
+    return false;
+}
+
+void BakedModel::adopt(std::vector<uint8_t>&& file) {
+    close();
+    buffer = std::move(file);
+    data = buffer.data();
+    size = buffer.size();
+}
+
+void BakedModel::close() {
+#ifdef __unix__
+    if (mapping) munmap(mapping, size);
+#endif
+    mapping = nullptr;
+    buffer.clear();
+    buffer.shrink_to_fit();
+    data = nullptr;
+    size = 0;
+}
+
+const char* BakedModel::string(uint32_t offset) const {
+    return reinterpret_cast<const char*>(data + header().strings + offset);
+}
+
+bool BakedModel::valid(const std::string& source) const {
+    if (size < sizeof(BakedHeader)) return false;
+    const BakedHeader& h = header();
+    if (memcmp(h.magic, "TDTB", 4) != 0 || h.version != kBakedModelVersion || h.file_size != size)
+        return false;
+
+    uint64_t source_size;
+    int64_t source_mtime;
+    stamp(source, source_size, source_mtime);
+    if (h.source_size != source_size || h.source_mtime != source_mtime) return false;
+
+    auto fits = [&](uint64_t offset, uint64_t bytes) {
+        return offset % 16 == 0 && offset <= size && bytes <= size - offset;
+    };
+    if (!fits(h.materials, uint64_t(h.n_materials) * sizeof(BakedMaterial))
+            || !fits(h.meshes, uint64_t(h.n_meshes) * sizeof(BakedMesh))
+            || !fits(h.nodes,  uint64_t(h.n_nodes)  * sizeof(BakedNode))
+            || !fits(h.strings, 0))
+        return false;
+
+    for (uint32_t i = 0; i < h.n_meshes; i++) {
+        const BakedMesh& m = meshes()[i];
+        if ((m.index_type != GL_UNSIGNED_SHORT && m.index_type != GL_UNSIGNED_INT)
+                || !fits(m.vertices, uint64_t(m.vertex_count) * sizeof(PackedVertex))
+                || !fits(m.indices,  uint64_t(m.index_count)  * indexSize(m.index_type)))
+            return false;
+    }
+    for (uint32_t i = 0; i < h.n_nodes; i++) {
+        const BakedNode& n = nodes()[i];
+        if (n.parent >= int32_t(i) || n.parent < (i == 0 ? -1 : 0)
+                || n.mesh < -1 || n.mesh >= int32_t(h.n_meshes)
+                || n.material < -1 || n.material >= int32_t(h.n_materials))
+            return false;
+    }
+    const char* strings_begin = string(0);
+    const size_t strings_size = size - h.strings;
+    for (uint32_t i = 0; i < h.n_materials; i++) {
+        for (uint32_t offset : materials()[i].texture) {
+            if (offset == kNoTexture) continue;
+            if (offset >= strings_size || !memchr(strings_begin + offset, '\0', strings_size - offset))
+                return false;
+        }
+    }
+    return true;
+}
+
+bool writeBakedModel(const std::string& path, const std::vector<uint8_t>& file) {
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out.write(reinterpret_cast<const char*>(file.data()), file.size());
+        if (!out) return false;
+    }
+    std::error_code error;
+    fs::rename(tmp, path, error);
+    if (error) {
+        fs::remove(tmp, error);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "glutils.h"
+#include "mesh.h"
+
+// The baked model format: what loadModelScene() gets out of assimp, in a
+// single file that is used in place once mapped into memory. All offsets
+// are in bytes from the start of the file, and every blob is 16 byte
+// aligned. Vertices are PackedVertex and indices are narrowed to their
+// index type, both ready for the mesh arena.
+//
+//   BakedHeader
+//   BakedMaterial[n_materials]
+//   BakedMesh[n_meshes]
+//   BakedNode[n_nodes]         parents precede their children
+//   strings                    texture paths, zero terminated
+//   vertex and index blobs
+//
+// Bump kBakedModelVersion whenever any of this, PackedVertex or the
+// import itself changes, so old files are baked again.
+static const uint32_t kBakedModelVersion = 1;
+
+struct BakedHeader {
+    char     magic[4]; // "TDTB"
+    uint32_t version;
+    uint64_t source_size;  // of the imported file, baked again when it
+    int64_t  source_mtime; // changes
+    uint32_t n_materials;
+    uint32_t n_meshes;
+    uint32_t n_nodes;
+    uint32_t _pad;
+    uint64_t materials;
+    uint64_t meshes;
+    uint64_t nodes;
+    uint64_t strings;
+    uint64_t file_size;
+};
+
+static const uint32_t kNoTexture = ~0u;
+struct BakedMaterial {
+    glm::vec3 diffuse_color;
+    float     shininess;
+    glm::vec3 emissive_color;
+    float     _pad0;
+    glm::vec3 specular_color;
+    float     _pad1;
+    uint32_t  texture[4]; // diffuse, normal, displacement and reflection paths,
+                          // relative to the model, as string offsets, or kNoTexture
+};
+
+enum BakedMeshFlags : uint32_t {
+    BAKED_VERTEX_COLORED = 1 << 0,
+    BAKED_TRANSPARENT    = 1 << 1, // Mesh::has_transparancy
+};
+struct BakedMesh {
+    uint64_t  vertices; // PackedVertex[vertex_count]
+    uint64_t  indices;  // index_count of index_type
+    uint32_t  vertex_count;
+    uint32_t  index_count;
+    uint32_t  index_type;
+    uint32_t  flags;
+    glm::vec3 aabb_min;
+    glm::vec3 aabb_max;
+};
+
+struct BakedNode {
+    int32_t   parent;   // -1 for the root
+    int32_t   mesh;     // -1 without one
+    int32_t   material; // -1 for the default material
+    uint32_t  _pad;
+    glm::vec3 position;
+    glm::vec3 rotation;
+    glm::vec3 scale;
+};
+
+static_assert(sizeof(BakedHeader)   == 80, "baked layout mismatch");
+static_assert(sizeof(BakedMaterial) == 64, "baked layout mismatch");
+static_assert(sizeof(BakedMesh)     == 56, "baked layout mismatch");
+static_assert(sizeof(BakedNode)     == 52, "baked layout mismatch");
+
+// Assembles a baked model in memory
+class BakedModelWriter {
+public:
+    void addMaterial(const BakedMaterial& material, const std::string texture_paths[4]);
+    // packs the mesh, see packVertices() and packIndices()
+    void addMesh(const Mesh& mesh);
+    // returns the index of the node
+    int32_t addNode(const BakedNode& node);
+
+    // The file, stamped with the size and modification time of `source`
+    std::vector<uint8_t> finish(const std::string& source) const;
+
+private:
+    std::vector<BakedMaterial> materials;
+    std::vector<BakedMesh> meshes;
+    std::vector<BakedNode> nodes;
+    std::string strings;
+    std::vector<uint8_t> blobs; // offsets in `meshes` are relative to this until finish()
+};
+
+// A read only view of a baked model, either mapped from a file or held in
+// memory. Pointers into it stay valid until it is closed or destroyed.
+class BakedModel {
+public:
+    BakedModel() = default;
+    BakedModel(const BakedModel&) = delete;
+    BakedModel& operator=(const BakedModel&) = delete;
+    ~BakedModel() { close(); }
+
+    // Maps `path`, failing if it is missing, malformed, of another version
+    // or baked from another revision of `source`
+    bool open(const std::string& path, const std::string& source);
+    // Takes over a file made by BakedModelWriter::finish()
+    void adopt(std::vector<uint8_t>&& file);
+    void close();
+
+    const BakedHeader&   header()   const { return *reinterpret_cast<const BakedHeader*>(data); }
+    const BakedMaterial* materials() const { return at<BakedMaterial>(header().materials); }
+    const BakedMesh*     meshes()    const { return at<BakedMesh>(header().meshes); }
+    const BakedNode*     nodes()     const { return at<BakedNode>(header().nodes); }
+    const char* string(uint32_t offset) const;
+
+    template<typename T> const T* at(uint64_t offset) const {
+        return reinterpret_cast<const T*>(data + offset);
+    }
+
+private:
+    bool valid(const std::string& source) const;
+
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    void* mapping = nullptr;
+    std::vector<uint8_t> buffer;
+};
+
+// Writes `file` to `path` through a temporary file, so a concurrent or
+// interrupted run never maps half of one. Returns false on failure.
+bool writeBakedModel(const std::string& path, const std::vector<uint8_t>& file);
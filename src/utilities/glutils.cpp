@@ -1,7 +1,20 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
 #include <vector>
 #include <glad/glad.h>
+#include <glm/gtc/packing.hpp>
 #include <program.hpp>
 #include "glutils.h"
+#include "textureCompression.hpp"
+
+// S3TC is an extension, and not in every GL header
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
 
 using std::vector;
 using glm::vec4;
@@ -9,57 +22,26 @@ using glm::vec3;
 using glm::vec2;
 typedef unsigned int uint;
 
-uint generateBuffer(const Mesh &mesh, bool doAddTangents) {
-    uint vaoID;
-    glGenVertexArrays(1, &vaoID);
-    glBindVertexArray(vaoID);
-
-    uint vertexBufferID;
-    glGenBuffers(1, &vertexBufferID);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-    glBufferData(GL_ARRAY_BUFFER, mesh.vertices.size() * sizeof(vec3), mesh.vertices.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
-    glEnableVertexAttribArray(0);
-
-    uint normalBufferID;
-    glGenBuffers(1, &normalBufferID);
-    glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
-    glBufferData(GL_ARRAY_BUFFER, mesh.normals.size() * sizeof(vec3), mesh.normals.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_TRUE, 3 * sizeof(float), 0);
-    glEnableVertexAttribArray(1);
+static uint instanceIndexBufferID = 0;
+static uint instanceIndexCount = 0;
 
-    uint indexBufferID;
-    glGenBuffers(1, &indexBufferID);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(uint), mesh.indices.data(), GL_STATIC_DRAW);
-
-    if (!mesh.textureCoordinates.empty()) {
-        uint textureBufferID;
-        glGenBuffers(1, &textureBufferID);
-        glBindBuffer(GL_ARRAY_BUFFER, textureBufferID);
-        glBufferData(GL_ARRAY_BUFFER, mesh.textureCoordinates.size() * sizeof(vec2), mesh.textureCoordinates.data(), GL_STATIC_DRAW);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), 0);
-        glEnableVertexAttribArray(2);
-    }
-
-    if (!mesh.colors.empty()) {
-        uint colorBufferID;
-        glGenBuffers(1, &colorBufferID);
-        glBindBuffer(GL_ARRAY_BUFFER, colorBufferID);
-        glBufferData(GL_ARRAY_BUFFER, mesh.colors.size() * sizeof(vec4), mesh.colors.data(), GL_STATIC_DRAW);
-        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), 0);
-        glEnableVertexAttribArray(3);
-    }
+void reserveInstanceIndices(uint count) {
+    if (instanceIndexBufferID == 0) glGenBuffers(1, &instanceIndexBufferID);
+    if (count <= instanceIndexCount) return;
 
-    if (doAddTangents || !mesh.textureCoordinates.empty())
-        addTangents(vaoID, mesh);
-    
-    return vaoID;
+    // respecify the storage of the same buffer name, so existing VAOs see it
+    instanceIndexCount = std::max(count, instanceIndexCount * 2);
+    vector<uint> indices(instanceIndexCount);
+    for (uint i = 0; i < instanceIndexCount; i++) indices[i] = i;
+    glBindBuffer(GL_ARRAY_BUFFER, instanceIndexBufferID);
+    glBufferData(GL_ARRAY_BUFFER, indices.size() * sizeof(uint), indices.data(), GL_STATIC_DRAW);
 }
 
-void addTangents(uint vaoID, const Mesh& mesh) {
-    vector<vec3> tangents(mesh.vertices.size());
-    vector<vec3> bitangents(mesh.vertices.size());
+// Per-triangle tangents and bitangents from the UV derivatives, the last
+// triangle sharing a vertex wins
+static void computeTangents(const Mesh& mesh, vector<vec3>& tangents, vector<vec3>& bitangents) {
+    tangents.assign(mesh.vertices.size(), vec3(0));
+    bitangents.assign(mesh.vertices.size(), vec3(0));
     
     for (uint i = 0; i < mesh.indices.size(); i+=3) {
         const vec3& pos1 = mesh.vertices[mesh.indices[i+0]];
@@ -99,22 +81,164 @@ void addTangents(uint vaoID, const Mesh& mesh) {
         bitangents[mesh.indices[i+1]] = bitangent;
         bitangents[mesh.indices[i+2]] = bitangent;
     }
-    
+}
+
+vector<PackedVertex> packVertices(const Mesh& mesh, bool doAddTangents) {
+    vector<vec3> tangents, bitangents;
+    bool has_tangents = (doAddTangents || !mesh.textureCoordinates.empty())
+        && mesh.textureCoordinates.size() == mesh.vertices.size();
+    if (has_tangents) computeTangents(mesh, tangents, bitangents);
+
+    vector<PackedVertex> out(mesh.vertices.size());
+    for (size_t i = 0; i < out.size(); i++) {
+        PackedVertex& v = out[i];
+        vec3 normal = (i < mesh.normals.size()) ? mesh.normals[i] : vec3(0);
+        v.position = mesh.vertices[i];
+        v.normal   = glm::packSnorm3x10_1x2(vec4(normal, 0));
+        v.tangent  = 0;
+        if (has_tangents) {
+            // the bitangent is rebuilt from the normal and tangent in the
+            // vertex shader, only its direction is kept
+            float sign = (glm::dot(glm::cross(normal, tangents[i]), bitangents[i]) < 0) ? -1 : 1;
+            v.tangent = glm::packSnorm3x10_1x2(vec4(tangents[i], sign));
+        }
+        v.uv    = (i < mesh.textureCoordinates.size()) ? glm::packHalf2x16(mesh.textureCoordinates[i]) : 0;
+        v.color = (i < mesh.colors.size()) ? glm::packUnorm4x8(mesh.colors[i]) : 0xffffffff;
+    }
+    return out;
+}
+
+uint indexType(const Mesh& mesh) {
+    for (uint index : mesh.indices)
+        if (index > 0xffff) return GL_UNSIGNED_INT;
+    return GL_UNSIGNED_SHORT;
+}
+
+uint indexSize(uint type) {
+    return (type == GL_UNSIGNED_SHORT) ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+vector<uint8_t> packIndices(const Mesh& mesh, uint type) {
+    vector<uint8_t> out(mesh.indices.size() * indexSize(type));
+    if (type == GL_UNSIGNED_SHORT) {
+        uint16_t* narrow = reinterpret_cast<uint16_t*>(out.data());
+        for (size_t i = 0; i < mesh.indices.size(); i++)
+            narrow[i] = uint16_t(mesh.indices[i]);
+    } else {
+        std::copy(mesh.indices.begin(), mesh.indices.end(), reinterpret_cast<uint32_t*>(out.data()));
+    }
+    return out;
+}
+
+uint generateBuffer(const Mesh &mesh, bool doAddTangents) {
+    uint vaoID;
+    glGenVertexArrays(1, &vaoID);
     glBindVertexArray(vaoID);
+
+    vector<PackedVertex> vertices = packVertices(mesh, doAddTangents);
+    uint vertexBufferID;
+    glGenBuffers(1, &vertexBufferID);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(PackedVertex), vertices.data(), GL_STATIC_DRAW);
+
+    uint indexBufferID;
+    glGenBuffers(1, &indexBufferID);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+    vector<uint8_t> indices = packIndices(mesh, indexType(mesh));
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size(), indices.data(), GL_STATIC_DRAW);
+
+    setPackedVertexAttributes(vaoID, vertexBufferID, indexBufferID);
+    return vaoID;
+}
+
+void setPackedVertexAttributes(uint vaoID, uint vertexBufferID, uint indexBufferID) {
+    reserveInstanceIndices(1);
+    glBindVertexArray(vaoID);
+
+    const GLsizei stride = sizeof(PackedVertex);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+    glVertexAttribPointer(0, 3, GL_FLOAT,                   GL_FALSE, stride, (void*)offsetof(PackedVertex, position));
+    glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV,      GL_TRUE,  stride, (void*)offsetof(PackedVertex, normal));
+    glVertexAttribPointer(2, 2, GL_HALF_FLOAT,              GL_FALSE, stride, (void*)offsetof(PackedVertex, uv));
+    glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE,           GL_TRUE,  stride, (void*)offsetof(PackedVertex, color));
+    glVertexAttribPointer(4, 4, GL_INT_2_10_10_10_REV,      GL_TRUE,  stride, (void*)offsetof(PackedVertex, tangent));
+    for (uint attribute = 0; attribute <= 4; attribute++)
+        glEnableVertexAttribArray(attribute);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+
+    glBindBuffer(GL_ARRAY_BUFFER, instanceIndexBufferID);
+    glVertexAttribIPointer(6, 1, GL_UNSIGNED_INT, sizeof(uint), 0);
+    glVertexAttribDivisor(6, 1);
+    glEnableVertexAttribArray(6);
+}
+
+// Pixels reach the texture through this buffer, orphaned for every upload
+// so the copy never waits on the driver finishing the previous one. The
+// memcpy into it is all the render thread pays, the driver transfers from
+// it asynchronously.
+static uint textureStagingBufferID = 0;
+
+// Binds the staging buffer, mapped for writing `bytes`. Returns nullptr,
+// with no buffer bound, if it can't be mapped.
+static void* mapTextureStaging(size_t bytes) {
+    if (textureStagingBufferID == 0) glGenBuffers(1, &textureStagingBufferID);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, textureStagingBufferID);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    void* staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (!staging) glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return staging;
+}
+
+// the GL format of a block compressed texture, 0 if the driver lacks it.
+// BC1 and BC3 are S3TC, which is an extension, if a ubiquitous one, and BC5
+// is RGTC, core since 3.0.
+static GLenum compressedFormat(BlockFormat format) {
+    static const bool s3tc = []{
+        GLint n = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+        for (GLint i = 0; i < n; i++) {
+            const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            if (name && strcmp(name, "GL_EXT_texture_compression_s3tc") == 0) return true;
+        }
+        return false;
+    }();
+    switch (format) {
+        case BLOCK_BC1: return s3tc ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT  : 0;
+        case BLOCK_BC3: return s3tc ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : 0;
+        case BLOCK_BC5: return GL_COMPRESSED_RG_RGTC2;
+    }
+    return 0;
+}
+
+// uploads the whole mip chain as is
+static void uploadCompressedTexture(const CompressedTexture& texture, GLenum format) {
+    glTexStorage2D(GL_TEXTURE_2D, texture.levels.size(), format, texture.width, texture.height);
     
-    uint tangentBufferID;
-    glGenBuffers(1, &tangentBufferID);
-    glBindBuffer(GL_ARRAY_BUFFER, tangentBufferID);
-    glBufferData(GL_ARRAY_BUFFER, mesh.vertices.size() * sizeof(vec3), tangents.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
-    glEnableVertexAttribArray(4);
+    size_t bytes = 0;
+    for (const vector<uint8_t>& level : texture.levels) bytes += level.size();
+    unsigned char* staging = static_cast<unsigned char*>(mapTextureStaging(bytes));
+    if (staging) {
+        size_t offset = 0;
+        for (const vector<uint8_t>& level : texture.levels) {
+            memcpy(staging + offset, level.data(), level.size());
+            offset += level.size();
+        }
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
     
-    uint bitangentBufferID;
-    glGenBuffers(1, &bitangentBufferID);
-    glBindBuffer(GL_ARRAY_BUFFER, bitangentBufferID);
-    glBufferData(GL_ARRAY_BUFFER, mesh.vertices.size() * sizeof(vec3), bitangents.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
-    glEnableVertexAttribArray(5);
+    size_t offset = 0;
+    uint width = texture.width, height = texture.height;
+    for (uint i = 0; i < texture.levels.size(); i++) {
+        const vector<uint8_t>& level = texture.levels[i];
+        const void* data = staging ? reinterpret_cast<const void*>(offset) : level.data();
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, i, 0, 0, width, height, format, level.size(), data);
+        offset += level.size();
+        width  = std::max(1u, width  / 2);
+        height = std::max(1u, height / 2);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 }
 
 uint generateTexture(const PNGImage& texture) {
@@ -128,8 +252,26 @@ uint generateTexture(const PNGImage& texture) {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texture.width, texture.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture.pixels.data());
-    //glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, texture.width, texture.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture.pixels.data());
+    const GLenum compressed_format = texture.compressed ? compressedFormat(texture.compressed->format) : 0;
+    if (compressed_format) {
+        uploadCompressedTexture(*texture.compressed, compressed_format);
+        return id;
+    }
+    
+    uint levels = 1;
+    while ((std::max(texture.width, texture.height) >> levels) > 0) levels++;
+    glTexStorage2D(GL_TEXTURE_2D, levels, GL_RGBA8, texture.width, texture.height);
+    
+    const size_t bytes = texture.pixels.size();
+    void* staging = mapTextureStaging(bytes);
+    if (staging) {
+        memcpy(staging, texture.pixels.data(), bytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture.width, texture.height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    } else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture.width, texture.height, GL_RGBA, GL_UNSIGNED_BYTE, texture.pixels.data());
+    }
     
     glGenerateMipmap(GL_TEXTURE_2D);
     
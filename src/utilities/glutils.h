@@ -1,12 +1,52 @@
 #pragma once
 
+#include <cstdint>
+#include <vector>
 #include "mesh.h"
 #include "imageLoader.hpp"
 
 
+// The interleaved vertex of the buffers made by generateBuffer, 28 bytes
+// where separate float streams took 72. Attribute locations are
+//   0 position, 1 normal, 2 UV, 3 colour, 4 tangent
+// The normal and tangent are signed normalized GL_INT_2_10_10_10_REV, with
+// the sign of the bitangent in the tangent's w, as the vertex shader
+// rebuilds the bitangent from the other two. UVs are half floats, which
+// resolve steps of 1/512 or finer in [-4, 4]. Colours are RGBA8, white without.
+struct PackedVertex {
+    glm::vec3 position;
+    uint32_t  normal;
+    uint32_t  tangent;
+    uint32_t  uv;
+    uint32_t  color;
+};
+static_assert(sizeof(PackedVertex) == 28, "PackedVertex should be tightly packed");
+
+// Tangents are computed for meshes with UVs, and if doAddTangents is set
+std::vector<PackedVertex> packVertices(const Mesh& mesh, bool doAddTangents=false);
+
+// GL_UNSIGNED_SHORT when all of the mesh's indices fit in 16 bits, which
+// halves the index memory and fetch of all but the largest meshes, else
+// GL_UNSIGNED_INT. The indices of a mesh are relative to its first vertex
+// wherever it is placed, see MeshArena, so this is a property of the mesh.
+unsigned int indexType(const Mesh& mesh);
+unsigned int indexSize(unsigned int type); // in bytes
+
+// mesh.indices narrowed to `type`, as bytes ready to upload
+std::vector<uint8_t> packIndices(const Mesh& mesh, unsigned int type);
+
+// Draw with the indexType() of the mesh
 unsigned int generateBuffer(const Mesh &mesh, bool doAddTangents=false);
 
-void addTangents(unsigned int vaoID, const Mesh& mesh);
+// Points the attributes of a VAO at a buffer of PackedVertex and an index
+// buffer, and at the instance indices below
+void setPackedVertexAttributes(unsigned int vaoID, unsigned int vertexBufferID, unsigned int indexBufferID);
+
+// Every VAO made by generateBuffer sources attribute 6 from one shared buffer
+// holding 0, 1, 2, ... with a divisor of 1, which gives the shaders an
+// instance index that honours the baseInstance of instanced draws.
+// Grows that buffer to hold at least `count` indices.
+void reserveInstanceIndices(unsigned int count);
 
 unsigned int generateTexture(const PNGImage& texture);
 
@@ -1,11 +1,19 @@
 #include "imageLoader.hpp"
+#include "textureCompression.hpp"
 #include <glm/vec2.hpp>
 #include <glm/vec4.hpp>
 #include <glm/gtc/noise.hpp>
+#include <cstring>
 #include <iostream>
 #include <vector>
+#include <future>
 #include <map>
+#include <mutex>
 #include <string>
+#include <tuple>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using glm::vec2;
 using glm::vec4;
@@ -61,72 +69,114 @@ vec4 PNGImage::at_bilinear(double u, double v) {
 	);
 }
 
+void flipRows(vector<unsigned char>& pixels, uint width, uint height) {
+	const size_t widthBytes = 4 * size_t(width);
+	vector<unsigned char> row(widthBytes);
+	for (uint y = 0; y < height / 2; y++) {
+		unsigned char* top    = pixels.data() + y * widthBytes;
+		unsigned char* bottom = pixels.data() + (height - 1 - y) * widthBytes;
+		memcpy(row.data(), top, widthBytes);
+		memcpy(top, bottom, widthBytes);
+		memcpy(bottom, row.data(), widthBytes);
+	}
+}
+
+void invertRedGreen(vector<unsigned char>& pixels) {
+	// 255 - x is x ^ 0xff, so this is a single xor over the whole buffer
+	static const unsigned char mask[16] = {
+		0xff,0xff,0,0, 0xff,0xff,0,0, 0xff,0xff,0,0, 0xff,0xff,0,0};
+	unsigned char* p = pixels.data();
+	const size_t n = pixels.size();
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask));
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), _mm_xor_si128(v, m));
+	}
+#endif
+	for (; i < n; i++) p[i] ^= mask[i % 16];
+}
+
 // Original source: https://raw.githubusercontent.com/lvandeve/lodepng/master/examples/example_decode.cpp
-PNGImage loadPNGFile(string filename, bool flip_handedness) {
+PNGImage loadPNGFile(string filename, bool flip_handedness, TextureCompression compression, JobSystem* jobs) {
 	vector<unsigned char> png;
-	vector<unsigned char> pixels; //the raw pixels
-	uint width, height;
+	PNGImage image;
 
-	//load and decode
+	//load and decode, the pixels end up 4 bytes per pixel, ordered RGBARGBA...
 	uint error = lodepng::load_file(png, filename);
-	if(!error) error = lodepng::decode(pixels, width, height, png);
+	if(!error) error = lodepng::decode(image.pixels, image.width, image.height, png);
 
 	//if there's an error, display it
-	if(error) std::cout << "decoder error " << error << ": " << lodepng_error_text(error) << std::endl;
-
-	//the pixels are now in the vector "image", 4 bytes per pixel, ordered RGBARGBA..., use it as texture, draw it, ...
+	if(error) {
+		std::cout << "decoder error " << error << ": " << lodepng_error_text(error) << std::endl;
+		image.width = image.height = 0;
+		image.pixels.clear();
+	}
 
 	// Unfortunately, images usually have their origin at the top left.
-	// OpenGL instead defines the origin to be on the _bottom_ left instead, so
-	// here's the world's most inefficient way to flip the image vertically.
+	// OpenGL instead defines the origin to be on the _bottom_ left instead.
+	flipRows(image.pixels, image.width, image.height);
+
+	if (flip_handedness)
+		invertRedGreen(image.pixels);
+	
+	image.alpha_mode = classifyAlpha(image.pixels);
+	image.has_transparancy = image.alpha_mode != ALPHA_OPAQUE;
+	
+	image.compressed = loadCompressedTexture(image, filename, flip_handedness, compression, jobs);
+	
+	return image;
+}
 
-	// You're welcome :)
+vector<PNGImage> loadPNGFiles(const vector<string>& filenames, bool flip_handedness, JobSystem& jobs) {
+	vector<PNGImage> images(filenames.size());
+	jobs.parallelFor(filenames.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			images[i] = loadPNGFile(filenames[i], flip_handedness);
+	});
+	return images;
+}
 
-	uint widthBytes = 4 * width;
+AlphaMode classifyAlpha(const vector<unsigned char>& pixels) {
+	size_t histogram[256] = {};
+	for (size_t i = 3; i < pixels.size(); i+=4)
+		histogram[pixels[i]]++;
 
-	for(uint row = 0; row < (height / 2); row++) {
-		for(uint col = 0; col < widthBytes; col++) {
-			std::swap(pixels[row * widthBytes + col], pixels[(height - 1 - row) * widthBytes + col]);
-		}
-	}
+	size_t n = pixels.size() / 4;
+	if (histogram[255] == n) return ALPHA_OPAQUE;
 
-	if (flip_handedness) {
-		for (uint xb = 0; xb < widthBytes; xb+=4)
-		for (uint y = 0; y < height; y++) {
-			unsigned char& r = pixels[y*widthBytes + xb + 0];
-			unsigned char& g = pixels[y*widthBytes + xb + 1];
-			unsigned char& b = pixels[y*widthBytes + xb + 2];
-			unsigned char& a = pixels[y*widthBytes + xb + 3];
-			
-			r = 255 - r;
-			g = 255 - g;
-		}
-	}
+	// the soft part, which an alpha test would turn hard
+	size_t partial = 0;
+	for (uint a = 16; a < 240; a++)
+		partial += histogram[a];
 
-	PNGImage image;
-	image.width = width;
-	image.height = height;
-	image.pixels = pixels;
-	
-	for (uint i = 3; i < pixels.size(); i+=4) {
-		if (pixels[i] < 255) {
-			image.has_transparancy = true;
-			break;
-		}
-	}
-	
-	return image;
+	return (partial * 32 <= n) ? ALPHA_MASKED : ALPHA_TRANSLUCENT;
 }
 
-PNGImage* loadPNGFileDynamic(string filename, bool flip_handedness) {
-	static map<string, PNGImage*> cache{};
-	if (cache.find(filename) == cache.end())
-		cache[filename] = loadPNGFileDynamicNoCaching(filename, flip_handedness);
-	return cache[filename];
+PNGImage* loadPNGFileDynamic(string filename, bool flip_handedness, TextureCompression compression, JobSystem* jobs) {
+	// called from the asset loader threads, the first caller decodes the
+	// file while any others asking for it wait for its result
+	static std::mutex mutex;
+	static map<std::tuple<string, bool, TextureCompression>, std::shared_future<PNGImage*>> cache{};
+	const auto key = std::make_tuple(filename, flip_handedness, compression);
+	std::promise<PNGImage*> decoded;
+	std::shared_future<PNGImage*> image;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = cache.find(key);
+		if (it != cache.end()) image = it->second;
+		else cache[key] = decoded.get_future().share();
+	}
+	if (image.valid()) return image.get();
+
+	PNGImage* out = loadPNGFileDynamicNoCaching(filename, flip_handedness, compression, jobs);
+	decoded.set_value(out);
+	return out;
 }
-PNGImage* loadPNGFileDynamicNoCaching(string filename, bool flip_handedness) {
+PNGImage* loadPNGFileDynamicNoCaching(string filename, bool flip_handedness, TextureCompression compression, JobSystem* jobs) {
 	PNGImage* out = new PNGImage;
-	*out = loadPNGFile(filename, flip_handedness);
+	*out = loadPNGFile(filename, flip_handedness, compression, jobs);
 	return out;
 }
 
@@ -154,6 +204,6 @@ PNGImage makePerlinNoisePNG(uint w, uint h, vector<float> scales) {
 	PNGImage image;
 	image.width  = w;
 	image.height = h;
-	image.pixels = pixels;
+	image.pixels = std::move(pixels);
 	return image;
 }
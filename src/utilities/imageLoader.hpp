@@ -1,27 +1,64 @@
 #pragma once
 
 #include "lodepng.h"
+#include "jobSystem.hpp"
 #include <glm/vec4.hpp>
+#include <memory>
 #include <vector>
 #include <string>
 
 typedef unsigned int uint;
 
+// How a texture uses its alpha channel
+enum AlphaMode {
+	ALPHA_OPAQUE,      // no alpha below 255
+	ALPHA_MASKED,      // close to binary, can be alpha tested instead of blended
+	ALPHA_TRANSLUCENT, // needs blending
+};
+
+// Whether loadPNGFile() also prepares a block compressed copy of the image
+// for the GPU, see textureCompression.hpp
+enum TextureCompression {
+	UNCOMPRESSED,
+	COMPRESS_COLOR,   // BC1, or BC3 with alpha
+	COMPRESS_NORMALS, // BC5
+};
+
+struct CompressedTexture;
 struct PNGImage {
 	uint width, height;
 	bool repeat_mirrored = false;
 	std::vector<unsigned char> pixels; // RGBA
-	bool has_transparancy = false;
+	bool has_transparancy = false; // any alpha below 255
+	AlphaMode alpha_mode = ALPHA_OPAQUE;
+	std::shared_ptr<const CompressedTexture> compressed; // uploaded in place of the pixels, if set
 	
 	glm::vec4 get(int x, int y);
 	glm::vec4 at_nearest(double u, double v);
 	glm::vec4 at_bilinear(double u, double v);
 };
 
-PNGImage loadPNGFile(std::string filename, bool flip_handedness=false);
+// Classifies RGBA pixels by a histogram of their alpha. Images where only
+// a small fraction of the pixels, like antialiased edges, are neither close
+// to transparent nor close to opaque are considered masked
+AlphaMode classifyAlpha(const std::vector<unsigned char>& pixels);
+
+// `jobs`, if given, is used to compress the image, see encodeBlocks()
+PNGImage loadPNGFile(std::string filename, bool flip_handedness=false, TextureCompression compression=UNCOMPRESSED, JobSystem* jobs=nullptr);
+
+// Decodes the files concurrently, in the order given
+std::vector<PNGImage> loadPNGFiles(const std::vector<std::string>& filenames, bool flip_handedness=false, JobSystem& jobs=jobSystem());
+
+// The steps loadPNGFile() takes after decoding, on RGBA pixels: turning the
+// image upside down, as OpenGL has its origin at the bottom left, and
+// inverting the red and green channels of normal maps of the other
+// handedness
+void flipRows(std::vector<unsigned char>& pixels, uint width, uint height);
+void invertRedGreen(std::vector<unsigned char>& pixels);
 
-PNGImage* loadPNGFileDynamic(std::string filename, bool flip_handedness=false);
-PNGImage* loadPNGFileDynamicNoCaching(std::string filename, bool flip_handedness=false);
+// cached per file and way of loading it
+PNGImage* loadPNGFileDynamic(std::string filename, bool flip_handedness=false, TextureCompression compression=UNCOMPRESSED, JobSystem* jobs=nullptr);
+PNGImage* loadPNGFileDynamicNoCaching(std::string filename, bool flip_handedness=false, TextureCompression compression=UNCOMPRESSED, JobSystem* jobs=nullptr);
 
 PNGImage makePerlinNoisePNG(uint w, uint h, float scale=0.1);
 
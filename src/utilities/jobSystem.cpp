@@ -0,0 +1,120 @@
+#include "jobSystem.hpp"
+#include <algorithm>
+
+// which pool and queue the current thread works for
+static thread_local const JobSystem* tls_pool = nullptr;
+static thread_local unsigned tls_queue = 0;
+
+JobSystem::JobSystem(unsigned threads) {
+	if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned i = 0; i < threads; i++)
+		queues.emplace_back(new Queue());
+	for (unsigned i = 1; i < threads; i++)
+		workers.emplace_back(&JobSystem::workerLoop, this, i);
+}
+
+JobSystem::~JobSystem() {
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers) worker.join();
+}
+
+unsigned JobSystem::currentQueue() const {
+	return (tls_pool == this) ? tls_queue : 0;
+}
+
+void JobSystem::run(Counter& counter, std::function<void()> job) {
+	counter.pending.fetch_add(1, std::memory_order_relaxed);
+	{
+		Queue& queue = *queues[currentQueue()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back({std::move(job), &counter});
+	}
+	queued.fetch_add(1, std::memory_order_release);
+	if (!workers.empty()) {
+		// taking the lock orders this against a worker about to sleep
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		wake.notify_one();
+	}
+}
+
+void JobSystem::wait(Counter& counter) {
+	unsigned self = currentQueue();
+	while (counter.pending.load(std::memory_order_acquire) > 0) {
+		Job job;
+		if (pop(self, job)) execute(job);
+		else std::this_thread::yield();
+	}
+}
+
+void JobSystem::parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& f) {
+	grain = std::max<size_t>(grain, 1);
+	if (count <= grain || queues.size() == 1) {
+		if (count) f(0, count);
+		return;
+	}
+	Counter counter;
+	for (size_t begin = 0; begin < count; begin += grain) {
+		size_t end = std::min(begin + grain, count);
+		run(counter, [&f, begin, end]{ f(begin, end); });
+	}
+	wait(counter);
+}
+
+bool JobSystem::pop(unsigned self, Job& job) {
+	{
+		Queue& own = *queues[self];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.jobs.empty()) {
+			job = std::move(own.jobs.back());
+			own.jobs.pop_back();
+			queued.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	for (size_t i = 1; i < queues.size(); i++) {
+		Queue& victim = *queues[(self + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.jobs.empty()) {
+			job = std::move(victim.jobs.front());
+			victim.jobs.pop_front();
+			queued.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+void JobSystem::execute(Job& job) {
+	job.fn();
+	job.counter->pending.fetch_sub(1, std::memory_order_release);
+}
+
+void JobSystem::workerLoop(unsigned self) {
+	tls_pool = this;
+	tls_queue = self;
+	while (true) {
+		Job job;
+		if (pop(self, job)) {
+			execute(job);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		wake.wait(lock, [this]{ return stopping || queued.load(std::memory_order_acquire) > 0; });
+		if (stopping) return;
+	}
+}
+
+static unsigned default_threads = 0;
+
+void setJobSystemThreads(unsigned threads) {
+	default_threads = threads;
+}
+
+JobSystem& jobSystem() {
+	static JobSystem pool(default_threads);
+	return pool;
+}
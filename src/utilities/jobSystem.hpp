@@ -0,0 +1,67 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed pool of worker threads with one job deque each. Threads push and
+// pop jobs at the back of their own deque, and steal from the front of the
+// others' when it runs dry. Waiting on a Counter runs jobs instead of
+// blocking, so jobs may themselves spawn and wait for other jobs.
+class JobSystem {
+public:
+	// Counts the unfinished jobs of a group
+	struct Counter {
+		std::atomic<size_t> pending{0};
+	};
+
+	// `threads` includes the thread creating the pool, which does its share
+	// of the work while it waits. 1 means no workers, 0 one thread per core.
+	explicit JobSystem(unsigned threads = 0);
+	~JobSystem();
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	unsigned threadCount() const { return unsigned(queues.size()); }
+
+	void run(Counter& counter, std::function<void()> job);
+	void wait(Counter& counter);
+
+	// Calls f(begin, end) over [0, count) in chunks of `grain`, returns once
+	// all of them are done
+	void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& f);
+
+private:
+	struct Job {
+		std::function<void()> fn;
+		Counter* counter;
+	};
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	unsigned currentQueue() const;
+	bool pop(unsigned self, Job& job);
+	void execute(Job& job);
+	void workerLoop(unsigned self);
+
+	std::vector<std::unique_ptr<Queue>> queues; // [0] is shared by all threads outside the pool
+	std::vector<std::thread> workers;
+	std::mutex sleep_mutex;
+	std::condition_variable wake;
+	std::atomic<size_t> queued{0};
+	std::atomic<bool> stopping{false};
+};
+
+// The pool shared by the renderer, created on first use
+JobSystem& jobSystem();
+
+// Only has an effect before the first call to jobSystem(), 0 means one
+// thread per core
+void setJobSystemThreads(unsigned threads);
@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <vector>
+#include <glad/glad.h>
+#include "meshArena.hpp"
+#include "glutils.h"
+
+// a buffer of `capacity` bytes holding the first `used` of `old`, which is deleted
+static uint grownBuffer(uint old, size_t used, size_t capacity) {
+    uint id;
+    glGenBuffers(1, &id);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+    glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, GL_STATIC_DRAW);
+    if (old) {
+        glBindBuffer(GL_COPY_READ_BUFFER, old);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+        glDeleteBuffers(1, &old);
+    }
+    return id;
+}
+
+void MeshArena::reserve(size_t vertex_capacity, size_t index_bytes) {
+    if (vertex_capacity <= vertexCapacity && index_bytes <= indexBytesCapacity) return;
+    if (!vaoID) glGenVertexArrays(1, &vaoID);
+
+    if (vertex_capacity > vertexCapacity) {
+        vertexCapacity = std::max(vertex_capacity, std::max<size_t>(vertexCapacity * 2, 1 << 16));
+        vertexBufferID = grownBuffer(vertexBufferID,
+            vertices * sizeof(PackedVertex), vertexCapacity * sizeof(PackedVertex));
+    }
+    if (index_bytes > indexBytesCapacity) {
+        indexBytesCapacity = std::max(index_bytes, std::max<size_t>(indexBytesCapacity * 2, 1 << 20));
+        indexBufferID = grownBuffer(indexBufferID, indexBytesUsed, indexBytesCapacity);
+    }
+    setPackedVertexAttributes(vaoID, vertexBufferID, indexBufferID);
+    glBindVertexArray(0);
+}
+
+MeshRange MeshArena::add(const Mesh& mesh, bool doAddTangents) {
+    std::vector<PackedVertex> packed = packVertices(mesh, doAddTangents);
+    const uint type = indexType(mesh);
+    std::vector<uint8_t> packed_indices = packIndices(mesh, type);
+    return add(packed.data(), packed.size(), packed_indices.data(), mesh.indices.size(), type);
+}
+
+MeshRange MeshArena::add(const PackedVertex* packed, size_t vertex_count,
+        const void* packed_indices, size_t index_count, uint type) {
+    const size_t size = indexSize(type);
+    const size_t index_offset = (indexBytesUsed + size - 1) / size * size;
+    reserve(vertices + vertex_count, index_offset + index_count * size);
+
+    MeshRange range;
+    range.vao        = vaoID;
+    range.indexType  = type;
+    range.firstIndex = uint(index_offset / size);
+    range.baseVertex = int(vertices);
+    range.indexCount = uint(index_count);
+    range.id         = meshes++;
+
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+    glBufferSubData(GL_ARRAY_BUFFER, vertices * sizeof(PackedVertex),
+        vertex_count * sizeof(PackedVertex), packed);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, indexBufferID); // not the VAO's element binding
+    glBufferSubData(GL_COPY_WRITE_BUFFER, index_offset, index_count * size, packed_indices);
+
+    vertices += vertex_count;
+    indexBytesUsed = index_offset + index_count * size;
+    return range;
+}
+
+MeshArena& meshArena() {
+    static MeshArena arena;
+    return arena;
+}
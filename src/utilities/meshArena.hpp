@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include "mesh.h"
+#include "glutils.h"
+
+typedef unsigned int uint;
+
+// Where a mesh was placed in a MeshArena
+struct MeshRange {
+    uint vao;        // the arena's, shared by all of its meshes
+    uint indexType;  // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, see indexType()
+    uint firstIndex; // into the index buffer, in units of indexType
+    int  baseVertex; // added to the mesh's indices
+    uint indexCount;
+    uint id;         // counts up from 0, for sort keys
+};
+
+// Static geometry suballocated from one interleaved vertex buffer and one
+// index buffer, behind a single VAO, so draws of different meshes need no
+// VAO switch. Draw with the base vertex variants of glDrawElements*, using
+// the offset firstIndex * indexSize(indexType). 16 and 32 bit indices share
+// the index buffer, each mesh's aligned to its own size. When full, the
+// buffers grow to twice the size, copying on the GPU, and the VAO is pointed
+// at the new ones.
+class MeshArena {
+public:
+    MeshArena() = default;
+    MeshArena(const MeshArena&) = delete;
+    MeshArena& operator=(const MeshArena&) = delete;
+
+    // Packs and appends a mesh, see packVertices()
+    MeshRange add(const Mesh& mesh, bool doAddTangents = false);
+
+    // Appends an already packed mesh, e.g. from a baked model
+    MeshRange add(const PackedVertex* vertices, size_t vertex_count,
+        const void* indices, size_t index_count, uint index_type);
+
+    uint vao() const { return vaoID; }
+    size_t vertexCount() const { return vertices; }
+    size_t indexBytes() const { return indexBytesUsed; }
+    uint meshCount() const { return meshes; }
+
+private:
+    void reserve(size_t vertex_capacity, size_t index_bytes);
+
+    uint vaoID = 0;
+    uint vertexBufferID = 0;
+    uint indexBufferID = 0;
+    size_t vertices = 0, vertexCapacity = 0;
+    size_t indexBytesUsed = 0, indexBytesCapacity = 0;
+    uint meshes = 0;
+};
+
+// The arena SceneNode::setMesh places meshes in
+MeshArena& meshArena();
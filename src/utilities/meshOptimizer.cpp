@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "meshOptimizer.hpp"
+
+using std::vector;
+using glm::vec3;
+typedef unsigned int uint;
+
+// A FIFO cache of vertex indices, as a timestamp per vertex. A vertex is
+// cached while fewer than `size` vertices were added after it.
+struct FifoCache {
+    vector<uint> timestamp;
+    uint time;
+    uint size;
+
+    FifoCache(size_t vertices, uint size) : timestamp(vertices, 0), time(size + 1), size(size) {}
+
+    // whether `vertex` had to be transformed
+    bool miss(uint vertex) {
+        if (time - timestamp[vertex] <= size) return false;
+        timestamp[vertex] = time++;
+        return true;
+    }
+    void clear() { time += size + 1; }
+};
+
+VertexCacheStats analyzeVertexCache(const Mesh& mesh, uint cache_size) {
+    FifoCache cache(mesh.vertices.size(), cache_size);
+    size_t misses = 0;
+    for (uint index : mesh.indices)
+        misses += cache.miss(index);
+
+    VertexCacheStats stats;
+    stats.acmr = mesh.indices.empty()  ? 0 : float(misses) / (mesh.indices.size() / 3);
+    stats.atvr = mesh.vertices.empty() ? 0 : float(misses) / mesh.vertices.size();
+    return stats;
+}
+
+// Moves vertex i to remap[i], dropping it where that is ~0u
+static void remapVertices(Mesh& mesh, const vector<uint>& remap, size_t count) {
+    auto apply = [&](auto& attribute) {
+        if (attribute.empty()) return;
+        std::decay_t<decltype(attribute)> out(count);
+        for (size_t i = 0; i < remap.size(); i++)
+            if (remap[i] != ~0u) out[remap[i]] = attribute[i];
+        attribute.swap(out);
+    };
+    apply(mesh.vertices);
+    apply(mesh.normals);
+    apply(mesh.textureCoordinates);
+    apply(mesh.colors);
+    for (uint& index : mesh.indices)
+        index = remap[index];
+}
+
+void weldVertices(Mesh& mesh) {
+    // every attribute of a vertex, zero where the mesh has none
+    struct Key {
+        float data[12];
+        bool operator==(const Key& other) const { return memcmp(data, other.data, sizeof(data)) == 0; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const { // FNV-1a
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(key.data);
+            size_t hash = 14695981039346656037ull;
+            for (size_t i = 0; i < sizeof(key.data); i++)
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+            return hash;
+        }
+    };
+
+    const size_t n = mesh.vertices.size();
+    std::unordered_map<Key, uint, KeyHash> unique;
+    unique.reserve(n);
+    vector<uint> remap(n);
+    for (size_t i = 0; i < n; i++) {
+        Key key = {};
+        memcpy(key.data + 0, &mesh.vertices[i], sizeof(vec3));
+        if (i < mesh.normals.size())            memcpy(key.data + 3,  &mesh.normals[i],            sizeof(vec3));
+        if (i < mesh.textureCoordinates.size()) memcpy(key.data + 6,  &mesh.textureCoordinates[i], sizeof(glm::vec2));
+        if (i < mesh.colors.size())             memcpy(key.data + 8,  &mesh.colors[i],             sizeof(glm::vec4));
+        remap[i] = unique.emplace(key, uint(unique.size())).first->second;
+    }
+    if (unique.size() == n) return;
+
+    // keep the first of each set of duplicates
+    auto apply = [&](auto& attribute) {
+        if (attribute.empty()) return;
+        for (size_t i = 0; i < n; i++)
+            attribute[remap[i]] = attribute[i]; // remap[i] <= i
+        attribute.resize(unique.size());
+    };
+    apply(mesh.vertices);
+    apply(mesh.normals);
+    apply(mesh.textureCoordinates);
+    apply(mesh.colors);
+    for (uint& index : mesh.indices)
+        index = remap[index];
+}
+
+// The weights of Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+static const uint kMaxCacheSize = 64;
+
+static float cacheScore(int position, uint cache_size) {
+    if (position < 0) return 0.0f;
+    if (position < 3) return 0.75f; // the last triangle, whichever order it is rasterised in
+    float x = 1.0f - float(position - 3) / float(cache_size - 3);
+    return std::pow(x, 1.5f);
+}
+
+static float valenceScore(uint live_triangles) {
+    // boosts vertices with few triangles left, to get rid of lone triangles
+    return live_triangles ? 2.0f / std::sqrt(float(live_triangles)) : 0.0f;
+}
+
+void optimizeVertexCache(Mesh& mesh, uint cache_size) {
+    const size_t n_vertices  = mesh.vertices.size();
+    const size_t n_triangles = mesh.indices.size() / 3;
+    if (n_triangles < 2) return;
+    cache_size = std::min(std::max(cache_size, 4u), kMaxCacheSize);
+    const vector<uint>& indices = mesh.indices;
+
+    // the triangles using each vertex, the live ones first
+    vector<uint> live(n_vertices, 0);
+    for (uint index : indices) live[index]++;
+    vector<uint> offset(n_vertices + 1, 0);
+    for (size_t v = 0; v < n_vertices; v++) offset[v + 1] = offset[v] + live[v];
+    vector<uint> adjacency(indices.size());
+    {
+        vector<uint> fill(offset.begin(), offset.end() - 1);
+        for (size_t t = 0; t < n_triangles; t++)
+            for (uint k = 0; k < 3; k++)
+                adjacency[fill[indices[t*3 + k]]++] = uint(t);
+    }
+
+    vector<int> cache_position(n_vertices, -1);
+    vector<float> vertex_score(n_vertices);
+    for (size_t v = 0; v < n_vertices; v++)
+        vertex_score[v] = valenceScore(live[v]);
+    vector<float> triangle_score(n_triangles);
+    for (size_t t = 0; t < n_triangles; t++)
+        triangle_score[t] = vertex_score[indices[t*3]] + vertex_score[indices[t*3+1]] + vertex_score[indices[t*3+2]];
+    vector<uint8_t> emitted(n_triangles, 0);
+
+    vector<uint> out;
+    out.reserve(indices.size());
+    vector<uint> cache, new_cache;
+    cache.reserve(cache_size + 3);
+    new_cache.reserve(cache_size + 3);
+
+    size_t best = std::max_element(triangle_score.begin(), triangle_score.end()) - triangle_score.begin();
+    size_t scan = 0; // triangles before this are emitted, for when the cache runs dry
+    while (true) {
+        emitted[best] = 1;
+        const uint* triangle = &indices[best*3];
+        new_cache.assign(triangle, triangle + 3);
+        for (uint k = 0; k < 3; k++) {
+            uint v = triangle[k];
+            out.push_back(v);
+            // swap it out of the vertex's live triangles
+            uint* begin = &adjacency[offset[v]];
+            uint* end = begin + live[v];
+            std::swap(*std::find(begin, end, uint(best)), end[-1]);
+            live[v]--;
+        }
+        for (uint v : cache)
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                new_cache.push_back(v);
+
+        // rescore the vertices that moved, or fell out, and their triangles
+        for (uint i = 0; i < new_cache.size(); i++) {
+            uint v = new_cache[i];
+            cache_position[v] = (i < cache_size) ? int(i) : -1;
+            vertex_score[v] = cacheScore(cache_position[v], cache_size) + valenceScore(live[v]);
+        }
+        float best_score = -1.0f;
+        for (uint v : new_cache) {
+            for (uint j = offset[v]; j < offset[v] + live[v]; j++) {
+                uint t = adjacency[j];
+                const uint* tv = &indices[t*3];
+                triangle_score[t] = vertex_score[tv[0]] + vertex_score[tv[1]] + vertex_score[tv[2]];
+                if (triangle_score[t] > best_score) {
+                    best_score = triangle_score[t];
+                    best = t;
+                }
+            }
+        }
+        if (new_cache.size() > cache_size) new_cache.resize(cache_size);
+        cache.swap(new_cache);
+
+        if (best_score < 0.0f) { // no live triangles in the cache, start anew
+            while (scan < n_triangles && emitted[scan]) scan++;
+            if (scan == n_triangles) break;
+            best = scan;
+        }
+    }
+    mesh.indices.swap(out);
+}
+
+void optimizeOverdraw(Mesh& mesh, float threshold, uint cache_size) {
+    const size_t n_triangles = mesh.indices.size() / 3;
+    if (n_triangles < 2) return;
+    const vector<uint>& indices = mesh.indices;
+    FifoCache cache(mesh.vertices.size(), cache_size);
+
+    // hard boundaries, where the cache order restarts with three misses
+    vector<size_t> hard;
+    for (size_t t = 0; t < n_triangles; t++) {
+        uint misses = cache.miss(indices[t*3]) + cache.miss(indices[t*3+1]) + cache.miss(indices[t*3+2]);
+        if (misses == 3 || t == 0) hard.push_back(t);
+    }
+    hard.push_back(n_triangles);
+
+    // soft boundaries within them, as soon as a cluster starting with a cold
+    // cache is about as cache friendly as the hard cluster as a whole
+    vector<size_t> clusters;
+    for (size_t c = 0; c + 1 < hard.size(); c++) {
+        const size_t begin = hard[c], end = hard[c + 1];
+        cache.clear();
+        size_t misses = 0;
+        for (size_t i = begin * 3; i < end * 3; i++) misses += cache.miss(indices[i]);
+        const float limit = threshold * float(misses) / float(end - begin);
+
+        cache.clear();
+        size_t start = begin;
+        misses = 0;
+        clusters.push_back(begin);
+        for (size_t t = begin; t + 1 < end; t++) {
+            for (uint k = 0; k < 3; k++) misses += cache.miss(indices[t*3 + k]);
+            if (float(misses) <= limit * float(t + 1 - start)) {
+                clusters.push_back(t + 1);
+                cache.clear();
+                start = t + 1;
+                misses = 0;
+            }
+        }
+    }
+    clusters.push_back(n_triangles);
+
+    // area weighted centroid and normal of each cluster, and of the mesh
+    const size_t n_clusters = clusters.size() - 1;
+    vector<vec3> centroid(n_clusters, vec3(0)), normal(n_clusters, vec3(0));
+    vec3 mesh_centroid(0);
+    float mesh_area = 0;
+    for (size_t c = 0; c < n_clusters; c++) {
+        float area = 0;
+        for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+            const vec3& a = mesh.vertices[indices[t*3]];
+            const vec3& b = mesh.vertices[indices[t*3+1]];
+            const vec3& d = mesh.vertices[indices[t*3+2]];
+            vec3 n = glm::cross(b - a, d - a); // twice the area
+            float l = glm::length(n);
+            centroid[c] += (a + b + d) * (l / 3.0f);
+            normal[c]   += n;
+            area        += l;
+        }
+        mesh_centroid += centroid[c];
+        mesh_area     += area;
+        if (area > 0) centroid[c] /= area;
+    }
+    if (mesh_area > 0) mesh_centroid /= mesh_area;
+
+    vector<float> outwardness(n_clusters);
+    for (size_t c = 0; c < n_clusters; c++) {
+        float l = glm::length(normal[c]);
+        outwardness[c] = (l > 0) ? glm::dot(centroid[c] - mesh_centroid, normal[c] / l) : 0.0f;
+    }
+    vector<uint> order(n_clusters);
+    for (uint c = 0; c < n_clusters; c++) order[c] = c;
+    std::stable_sort(order.begin(), order.end(), [&](uint a, uint b) {
+        return outwardness[a] > outwardness[b];
+    });
+
+    vector<uint> out;
+    out.reserve(indices.size());
+    for (uint c : order)
+        out.insert(out.end(), indices.begin() + clusters[c]*3, indices.begin() + clusters[c + 1]*3);
+    mesh.indices.swap(out);
+}
+
+void optimizeVertexFetch(Mesh& mesh) {
+    vector<uint> remap(mesh.vertices.size(), ~0u);
+    uint count = 0;
+    for (uint index : mesh.indices)
+        if (remap[index] == ~0u) remap[index] = count++;
+    remapVertices(mesh, remap, count);
+}
+
+void optimizeMesh(Mesh& mesh, const std::string& name) {
+    const size_t vertices_before = mesh.vertices.size();
+    const VertexCacheStats before = analyzeVertexCache(mesh);
+
+    weldVertices(mesh);
+    optimizeVertexCache(mesh);
+    optimizeOverdraw(mesh);
+    optimizeVertexFetch(mesh);
+
+    const VertexCacheStats after = analyzeVertexCache(mesh);
+    printf("mesh '%s': %zu -> %zu vertices, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+        name.c_str(), vertices_before, mesh.vertices.size(),
+        before.acmr, after.acmr, before.atvr, after.atvr);
+}
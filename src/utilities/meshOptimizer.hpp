@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include "mesh.h"
+
+// Post-transform vertex cache efficiency of a mesh's index order, simulating
+// a FIFO cache. ACMR is the vertices transformed per triangle, between 0.5
+// and 3, ATVR those per vertex of the mesh, 1 at best.
+struct VertexCacheStats {
+    float acmr;
+    float atvr;
+};
+VertexCacheStats analyzeVertexCache(const Mesh& mesh, unsigned int cache_size = 16);
+
+// Merges vertices whose attributes are bitwise identical
+void weldVertices(Mesh& mesh);
+
+// Reorders the triangles for the post-transform vertex cache, greedily
+// emitting the triangle whose vertices score highest on recency in a
+// simulated LRU cache and on how few triangles still use them (Forsyth)
+void optimizeVertexCache(Mesh& mesh, unsigned int cache_size = 32);
+
+// Splits the triangle order into clusters at points where the cache order
+// allows it, without the ACMR of a cluster exceeding `threshold` times the
+// ACMR of the run it was split from, and sorts the clusters by how much
+// they face outwards from the centre of the mesh. Drawing the outermost
+// surfaces first lets the depth test reject more of what is behind them,
+// from any direction. Run it after optimizeVertexCache().
+void optimizeOverdraw(Mesh& mesh, float threshold = 1.05f, unsigned int cache_size = 16);
+
+// Renumbers the vertices in the order they are first used by the indices,
+// dropping unused ones, so the vertex fetch walks memory linearly
+void optimizeVertexFetch(Mesh& mesh);
+
+// All of the above, in order, printing the statistics before and after
+void optimizeMesh(Mesh& mesh, const std::string& name);
@@ -14,6 +14,8 @@
 #include <assert.h>
 #include "mesh.h"
 #include "imageLoader.hpp"
+#include "meshOptimizer.hpp"
+#include "bakedModel.hpp"
 
 typedef unsigned int uint;
 using std::vector;
@@ -22,55 +24,72 @@ using std::cout;
 using std::cerr;
 using std::endl;
 
-SceneNode* buildSceneNodes(
+// How the diffuse, normal, displacement and reflection textures of a
+// material are compressed. Displacement maps are sampled as heights, and
+// are left uncompressed.
+static const TextureCompression texture_compression[4] = {
+	COMPRESS_COLOR, COMPRESS_NORMALS, UNCOMPRESSED, COMPRESS_COLOR};
+
+// Flattens the node tree into `baked`, one record per SceneNode it becomes.
+// Returns the index of the node's record.
+static int32_t bakeNodes(
+		const aiScene* scene,
 		const aiNode* node,
-		const vector<Mesh>& meshes,
-		const vector<Material*>& mat_lookup) {
+		int32_t parent,
+		BakedModelWriter& baked) {
 	if (DEBUG) cout << "Building node from " << node->mName.data << "..." << endl;
 	
 	// filter semantic-only nodes
 	if (node->mTransformation.IsIdentity()
 			&& node->mNumMeshes == 0
 			&& node->mNumChildren == 1)
-		return buildSceneNodes(node->mChildren[0], meshes, mat_lookup);
+		return bakeNodes(scene, node->mChildren[0], parent, baked);
 	
-	SceneNode* out = createSceneNode();
+	BakedNode out = {};
+	out.parent   = parent;
+	out.mesh     = -1;
+	out.material = -1;
+	out.scale    = vec3(1, 1, 1);
 
 	if (!node->mTransformation.IsIdentity()) {
 		aiQuaterniont<float> rotation;
 		aiVector3t<float> position, scaling;
 		node->mTransformation.Decompose(scaling, rotation, position);
-		for(uint i=0; i<3; i++) out->position[i] = position[i];
-		for(uint i=0; i<3; i++) out->scale[i]    = scaling[i];
-		out->rotation = glm::eulerAngles(glm::quat(
+		for(uint i=0; i<3; i++) out.position[i] = position[i];
+		for(uint i=0; i<3; i++) out.scale[i]    = scaling[i];
+		out.rotation = glm::eulerAngles(glm::quat(
 			rotation.w, rotation.x, rotation.y, rotation.z));
 	}
+	int32_t index = baked.addNode(out);
 
 	for (uint i = 0; i < node->mNumMeshes; i++) {
-		SceneNode* mesh_node = createSceneNode();
-		out->children.push_back(mesh_node);
 		uint meshidx = node->mMeshes[i];
-		
-		mesh_node->setMaterial(*mat_lookup[meshidx]);
-		mesh_node->setMesh(&meshes[meshidx]);
-		
+		uint matidx = scene->mMeshes[meshidx]->mMaterialIndex;
+		BakedNode mesh_node = {};
+		mesh_node.parent   = index;
+		mesh_node.mesh     = meshidx;
+		mesh_node.material = (matidx < scene->mNumMaterials) ? int32_t(matidx) : -1;
+		mesh_node.scale    = vec3(1, 1, 1);
+		baked.addNode(mesh_node);
 	}
 
 	for (uint i=0; i<node->mNumChildren; i++)
-		out->children.push_back(buildSceneNodes(node->mChildren[i], meshes, mat_lookup));
+		bakeNodes(scene, node->mChildren[i], index, baked);
 	
-	return out;
+	return index;
 }
 
-SceneNode* loadModelScene(const std::string& dirname, const std::string& filename, const map<int, Material>& overrides) {
+// Runs assimp over the model, returning it baked
+static vector<uint8_t> importModel(const std::string& dirname, const std::string& filename) {
 	Assimp::Importer importer;
+	BakedModelWriter baked;
 
 	const aiScene* scene = importer.ReadFile(dirname + "/" + filename,
 		aiProcess_CalcTangentSpace
 		//| aiProcess_FlipWindingOrder
 		| aiProcess_Triangulate
 		| aiProcess_GenNormals
-		| aiProcess_ImproveCacheLocality
+		//| aiProcess_ImproveCacheLocality // done by optimizeMesh() below
 		//| aiProcess_JoinIdenticalVertices
 		| aiProcess_SortByPType
 	);
@@ -79,17 +98,21 @@ SceneNode* loadModelScene(const std::string& dirname, const std::string& filenam
 		throw 1;
 	}
 	
-	// read materials
-	uint j=0;
-	Material default_material;
-	vector<Material> materials(scene->mNumMaterials);
-	for (Material& material : materials) {
-		const aiMaterial* aimat = scene->mMaterials[j++];
+	// read materials, with the defaults of Material
+	const Material default_material;
+	for (uint j=0; j < scene->mNumMaterials; j++) {
+		const aiMaterial* aimat = scene->mMaterials[j];
+		BakedMaterial material = {};
+		material.diffuse_color  = default_material.diffuse_color;
+		material.emissive_color = default_material.emissive_color;
+		material.specular_color = default_material.specular_color;
+		material.shininess      = default_material.shininess;
+		std::string texture_paths[4]; // relative to dirname
 		
 		// print material
 		aiString name; aimat->Get(AI_MATKEY_NAME, name);
 		if (DEBUG){
-			cout << "Read material #" << j-1 << " '" << name.data << "':" << endl;
+			cout << "Read material #" << j << " '" << name.data << "':" << endl;
 			for (uint i=0; i < aimat->mNumProperties; i++)
 			cout << "   " << aimat->mProperties[i]->mKey.data << endl;
 		}
@@ -115,41 +138,31 @@ SceneNode* loadModelScene(const std::string& dirname, const std::string& filenam
 		if (aimat->GetTextureCount(aiTextureType_DIFFUSE)) {
 			aiString path; aimat->GetTexture(aiTextureType_DIFFUSE, 0, &path);
 			if (DEBUG) cout << "  diffuse texture path: " << dirname << "/" << path.data << endl;
-			material.diffuse_texture = loadPNGFileDynamic(dirname + "/" + path.data);
+			texture_paths[0] = path.data;
 		}
 		if (aimat->GetTextureCount(aiTextureType_NORMALS)) {
 			aiString path; aimat->GetTexture(aiTextureType_NORMALS, 0, &path);
 			if (DEBUG) cout << "  normal texture path: " << dirname << "/" << path.data << endl;
-			material.normal_texture = loadPNGFileDynamic(dirname + "/" + path.data);
+			texture_paths[1] = path.data;
 		}
 		if (aimat->GetTextureCount(aiTextureType_DISPLACEMENT)) {
 			aiString path; aimat->GetTexture(aiTextureType_DISPLACEMENT, 0, &path);
 			if (DEBUG) cout << "  displacement texture path: " << dirname << "/" << path.data << endl;
-			material.displacement_texture = loadPNGFileDynamic(dirname + "/" + path.data);
+			texture_paths[2] = path.data;
 		}
 		if (aimat->GetTextureCount(aiTextureType_REFLECTION)) {
 			aiString path; aimat->GetTexture(aiTextureType_REFLECTION, 0, &path);
 			if (DEBUG) cout << "  displacement texture path: " << dirname << "/" << path.data << endl;
-			material.reflection_texture = loadPNGFileDynamic(dirname + "/" + path.data);
+			texture_paths[3] = path.data;
 		}
 		
+		baked.addMaterial(material, texture_paths);
 	}
 	
-	// apply material overriders to material list
-	for (auto override : overrides) {
-		Material& mat = (override.first>=0) 
-			? materials[override.first] 
-			: default_material;
-		mat = mat.apply(override.second);
-	}
-	
-	vector<Mesh>     meshes(  scene->mNumMeshes);
-	vector<Material*> mat_lookup(scene->mNumMeshes); // to be passed to buildSceneNodes
-
 	// read meshes
-	j=0;
-	for (Mesh& mesh : meshes) {
-		const aiMesh* aimesh = scene->mMeshes[j++];
+	for (uint j=0; j < scene->mNumMeshes; j++) {
+		const aiMesh* aimesh = scene->mMeshes[j];
+		Mesh mesh;
 		for (uint i=0;  i < aimesh->mNumVertices; i++){
 			mesh.vertices.push_back({
 				aimesh->mVertices[i].x,
@@ -162,10 +175,6 @@ SceneNode* loadModelScene(const std::string& dirname, const std::string& filenam
 				aimesh->mNormals[i].z,
 			});
 		}
-
-		mat_lookup[j-1] = (aimesh->mMaterialIndex < meshes.size())
-			? &materials[aimesh->mMaterialIndex]
-			: &default_material;
 		
 		if (aimesh->GetNumUVChannels() >= 1)
 		for (uint i=0;  i < aimesh->mNumVertices; i++){
@@ -197,10 +206,110 @@ SceneNode* loadModelScene(const std::string& dirname, const std::string& filenam
 				aimesh->mFaces[i].mIndices[2],
 			});
 		}
+		
+		// weld, and reorder for the vertex cache and overdraw
+		optimizeMesh(mesh, filename + "/" + aimesh->mName.data);
+		baked.addMesh(mesh);
+	}
+	
+	bakeNodes(scene, scene->mRootNode, -1, baked);
+	return baked.finish(dirname + "/" + filename);
+}
+
+SceneNode* buildModelScene(
+		const BakedModel& baked,
+		const std::string& dirname,
+		const map<int, Material>& overrides) {
+	const BakedHeader& header = baked.header();
+	if (header.n_nodes == 0) return createSceneNode();
+
+	Material default_material;
+	vector<Material> materials(header.n_materials);
+	for (uint j=0; j < header.n_materials; j++) {
+		const BakedMaterial& baked_material = baked.materials()[j];
+		Material& material = materials[j];
+		material.diffuse_color  = baked_material.diffuse_color;
+		material.emissive_color = baked_material.emissive_color;
+		material.specular_color = baked_material.specular_color;
+		material.shininess      = baked_material.shininess;
+		PNGImage** textures[4] = {
+			&material.diffuse_texture,
+			&material.normal_texture,
+			&material.displacement_texture,
+			&material.reflection_texture,
+		};
+		for (uint k=0; k < 4; k++)
+			if (baked_material.texture[k] != kNoTexture)
+				*textures[k] = loadPNGFileDynamic(dirname + "/" + baked.string(baked_material.texture[k]), false, texture_compression[k]);
 	}
 	
-	// build scene node tree:
-	SceneNode* out = buildSceneNodes(scene->mRootNode, meshes, mat_lookup);
+	// apply material overriders to material list
+	for (auto override : overrides) {
+		Material& mat = (override.first>=0) 
+			? materials[override.first] 
+			: default_material;
+		mat = mat.apply(override.second);
+	}
+	
+	// meshes are uploaded straight from the baked vertex and index blobs
+	vector<MeshRange> ranges(header.n_meshes);
+	vector<bool> uploaded(header.n_meshes, false);
+	
+	vector<SceneNode*> nodes(header.n_nodes);
+	for (uint i=0; i < header.n_nodes; i++) {
+		const BakedNode& baked_node = baked.nodes()[i];
+		SceneNode* node = nodes[i] = createSceneNode();
+		node->position = baked_node.position;
+		node->rotation = baked_node.rotation;
+		node->scale    = baked_node.scale;
+		if (baked_node.parent >= 0)
+			nodes[baked_node.parent]->children.push_back(node);
+		
+		if (baked_node.mesh < 0) continue;
+		node->setMaterial((baked_node.material >= 0) ? materials[baked_node.material] : default_material);
+		
+		const BakedMesh& mesh = baked.meshes()[baked_node.mesh];
+		if (!uploaded[baked_node.mesh]) {
+			ranges[baked_node.mesh] = meshArena().add(
+				baked.at<PackedVertex>(mesh.vertices), mesh.vertex_count,
+				baked.at<void>(mesh.indices), mesh.index_count, mesh.index_type);
+			uploaded[baked_node.mesh] = true;
+		}
+		node->setMesh(ranges[baked_node.mesh], mesh.aabb_min, mesh.aabb_max,
+			mesh.flags & BAKED_VERTEX_COLORED, mesh.flags & BAKED_TRANSPARENT);
+	}
+	
+	SceneNode* out = nodes[0];
 	out->rotation.x += M_PI/2; // account for my weird coordinates. Z is upward damnit!
 	return out;
 }
+
+std::string bakedModelPath(const std::string& dirname, const std::string& filename) {
+	return dirname + "/" + filename + ".baked";
+}
+
+std::shared_ptr<BakedModel> prepareModel(const std::string& dirname, const std::string& filename, JobSystem* jobs) {
+	const std::string path = bakedModelPath(dirname, filename);
+	auto baked = std::make_shared<BakedModel>();
+	if (!baked->open(path, dirname + "/" + filename)) {
+		vector<uint8_t> file = importModel(dirname, filename);
+		if (!writeBakedModel(path, file))
+			cerr << "Unable to write " << path << endl;
+		baked->adopt(std::move(file));
+	}
+	
+	// decode and compress the textures here, buildModelScene() then finds
+	// them cached
+	const BakedHeader& header = baked->header();
+	for (uint j=0; j < header.n_materials; j++)
+		for (uint k=0; k < 4; k++) {
+			uint32_t texture = baked->materials()[j].texture[k];
+			if (texture != kNoTexture)
+				loadPNGFileDynamic(dirname + "/" + baked->string(texture), false, texture_compression[k], jobs);
+		}
+	return baked;
+}
+
+SceneNode* loadModelScene(const std::string& dirname, const std::string& filename, const map<int, Material>& overrides) {
+	return buildModelScene(*prepareModel(dirname, filename), dirname, overrides);
+}
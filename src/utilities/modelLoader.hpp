@@ -2,12 +2,36 @@
 
 #include "../sceneGraph.hpp"
 #include "material.hpp"
+#include <memory>
 #include <string>
 #include <map>
 
 #define DEBUG false
 
+// Imports a model with assimp the first time, and bakes it next to the
+// source, see bakedModel.hpp. Later runs map the baked file instead, until
+// the source file changes. Delete the baked file to force an import, e.g.
+// after only changing the .bin or textures next to a .gltf.
 SceneNode* loadModelScene(
 	const std::string& dirname,
 	const std::string& filename, //basename
 	const std::map<int, Material>& overrides={});
+
+// The two halves of loadModelScene(). prepareModel() maps or imports the
+// model and decodes its textures, compressing them on `jobs` if given, and
+// may run on any thread.
+// buildModelScene() creates the nodes and uploads the meshes and textures,
+// and must run on the thread owning the GL context.
+class BakedModel;
+class JobSystem;
+std::shared_ptr<BakedModel> prepareModel(
+	const std::string& dirname,
+	const std::string& filename,
+	JobSystem* jobs = nullptr);
+SceneNode* buildModelScene(
+	const BakedModel& baked,
+	const std::string& dirname,
+	const std::map<int, Material>& overrides={});
+
+// where loadModelScene() keeps the baked form of a model
+std::string bakedModelPath(const std::string& dirname, const std::string& filename);
@@ -0,0 +1,105 @@
+#include "programCache.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+namespace Gloom
+{
+    static std::string cache_directory = "shader_cache";
+
+    struct BinaryHeader {
+        char     magic[4]; // "GLPB"
+        uint32_t format;   // as given by glGetProgramBinary
+        uint64_t key;
+        uint64_t length;
+    };
+
+    void setProgramCacheDirectory(std::string const &path) {
+        cache_directory = path;
+    }
+
+    static void hashBytes(uint64_t& hash, const void* data, size_t size) { // FNV-1a
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+
+    static uint64_t cacheKey(std::vector<std::string> const &sources) {
+        uint64_t hash = 14695981039346656037ull;
+        for (const std::string& source : sources) {
+            uint64_t length = source.size(); // so moving text between stages changes the key
+            hashBytes(hash, &length, sizeof(length));
+            hashBytes(hash, source.data(), source.size());
+        }
+        for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+            const char* value = reinterpret_cast<const char*>(glGetString(name));
+            if (value) hashBytes(hash, value, strlen(value) + 1);
+        }
+        return hash;
+    }
+
+    static std::string cachePath(uint64_t key) {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+        return (fs::path(cache_directory) / name).string();
+    }
+
+    static bool supported() {
+        if (cache_directory.empty()) return false;
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        return formats > 0;
+    }
+
+    bool loadProgramBinary(GLuint program, std::vector<std::string> const &sources) {
+        if (!supported()) return false;
+        uint64_t key = cacheKey(sources);
+
+        std::ifstream file(cachePath(key), std::ios::binary);
+        if (!file) return false;
+        BinaryHeader header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+                || memcmp(header.magic, "GLPB", 4) != 0
+                || header.key != key)
+            return false;
+        std::vector<char> binary(header.length);
+        if (!file.read(binary.data(), binary.size())) return false;
+
+        glProgramBinary(program, header.format, binary.data(), GLsizei(binary.size()));
+        GLint status = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        return status == GL_TRUE; // rejected after a driver update, probably
+    }
+
+    void storeProgramBinary(GLuint program, std::vector<std::string> const &sources) {
+        if (!supported()) return;
+
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) return;
+        BinaryHeader header = {{'G', 'L', 'P', 'B'}, 0, cacheKey(sources), uint64_t(length)};
+        std::vector<char> binary(length);
+        glGetProgramBinary(program, length, nullptr, &header.format, binary.data());
+
+        std::error_code error;
+        fs::create_directories(cache_directory, error);
+        std::string path = cachePath(header.key);
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(binary.data(), binary.size());
+            if (!file) {
+                std::cerr << "Could not write the program binary " << temporary << std::endl;
+                return;
+            }
+        }
+        // so a concurrent or interrupted run never reads a partial file
+        fs::rename(temporary, path, error);
+    }
+}
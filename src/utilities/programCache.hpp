@@ -0,0 +1,25 @@
+#pragma once
+
+// System headers
+#include <glad/glad.h>
+
+// Standard headers
+#include <string>
+#include <vector>
+
+
+namespace Gloom
+{
+    /* Linked program binaries are kept in this directory between runs, keyed
+       by a hash of the sources, including any injected defines, and of the
+       driver's vendor, renderer and version strings. Empty disables it */
+    void setProgramCacheDirectory(std::string const &path);
+
+    /* Specifies `program` from the binary cached for these sources. Returns
+       false on a miss, or if the driver rejects the binary */
+    bool loadProgramBinary(GLuint program, std::vector<std::string> const &sources);
+
+    /* Caches the binary of `program`, which should have been linked with
+       GL_PROGRAM_BINARY_RETRIEVABLE_HINT set */
+    void storeProgramBinary(GLuint program, std::vector<std::string> const &sources);
+}
@@ -5,16 +5,37 @@
 // System headers
 #include <glad/glad.h>
 
+// Local headers
+#include "programCache.hpp"
+
 // Standard headers
 #include <cassert>
+#include <cstdint>
 #include <fstream>
 #include <memory>
 #include <string>
 #include <map>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+// Uniform name hashed at compile time, for use with Shader::location(uint32_t)
+#define UNIFORM(name) (std::integral_constant<uint32_t, Gloom::uniformHash(name)>::value)
 
 
 namespace Gloom
 {
+    /* FNV-1a hash of a uniform name */
+    constexpr uint32_t uniformHash(const char* name)
+    {
+        uint32_t hash = 2166136261u;
+        for (; *name; name++)
+            hash = (hash ^ uint32_t((unsigned char)*name)) * 16777619u;
+        return hash;
+    }
+
     class Shader
     {
     public:
@@ -26,13 +47,14 @@ namespace Gloom
         GLuint get()        { return mProgram; }
         void   destroy()    { glDeleteProgram(mProgram); }
 
-        GLint inline location(std::string const& name) {
-            static std::map<std::string, GLint> cache {};
-            auto it = cache.find(name);
-            if (it == cache.end())
-                return cache[name] = glGetUniformLocation(mProgram, name.c_str());
-            return it->second;
-            //return  glGetUniformLocation(mProgram, name.c_str());
+        /* Uniform locations are reflected once at link time. Unknown or
+           inactive uniforms give -1, which glUniform* silently ignores */
+        GLint inline location(uint32_t nameHash) const {
+            auto it = mLocations.find(nameHash);
+            return (it != mLocations.end()) ? it->second : -1;
+        }
+        GLint inline location(std::string const& name) const {
+            return location(uniformHash(name.c_str()));
         }
 
         /* Attach a shader to the current shader program */
@@ -49,7 +71,13 @@ namespace Gloom
             }
             auto src = std::string(std::istreambuf_iterator<char>(fd),
                                   (std::istreambuf_iterator<char>()));
+            attachSource(src, filename);
+        }
 
+        /* Attach a shader given as source, the stage is deduced from the
+           extension of `filename`, which is also used in error messages */
+        void attachSource(std::string const &src, std::string const &filename)
+        {
             // Create shader object
             const char * source = src.c_str();
             auto shader = create(filename);
@@ -66,7 +94,7 @@ namespace Gloom
                 fprintf(stderr, "%s\n%s", filename.c_str(), buffer.get());
             }
 
-            assert(mStatus);
+            assert(mStatus || !mRequireSuccess);
 
             // Attach shader and free allocated memory
             glAttachShader(mProgram, shader);
@@ -90,7 +118,44 @@ namespace Gloom
                 fprintf(stderr, "%s\n", buffer.get());
             }
 
-            assert(mStatus);
+            assert(mStatus || !mRequireSuccess);
+
+            reflectUniforms();
+        }
+
+
+        /* Builds the name hash -> location table of all active uniforms */
+        void reflectUniforms()
+        {
+            mLocations.clear();
+
+            GLint count = 0, maxLength = 0;
+            glGetProgramiv(mProgram, GL_ACTIVE_UNIFORMS, &count);
+            glGetProgramiv(mProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+            std::vector<char> buffer(maxLength + 1);
+
+            auto add = [this](std::string const& name) {
+                GLint loc = glGetUniformLocation(mProgram, name.c_str());
+                if (loc < 0) return; // member of a uniform block
+                auto inserted = mLocations.emplace(uniformHash(name.c_str()), loc);
+                if (!inserted.second && inserted.first->second != loc)
+                    fprintf(stderr, "Uniform name hash collision on \"%s\"\n", name.c_str());
+            };
+
+            for (GLint i = 0; i < count; i++) {
+                GLint size; GLenum type; GLsizei length;
+                glGetActiveUniform(mProgram, i, maxLength, &length, &size, &type, buffer.data());
+                std::string name(buffer.data(), length);
+                add(name);
+
+                // arrays of basic types are reported once as "name[0]"
+                if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+                    std::string base = name.substr(0, name.size() - 3);
+                    add(base);
+                    for (GLint j = 1; j < size; j++)
+                        add(base + "[" + std::to_string(j) + "]");
+                }
+            }
         }
 
 
@@ -99,9 +164,78 @@ namespace Gloom
         void makeBasicShader(std::string const &vertexFilename,
                              std::string const &fragmentFilename)
         {
-            attach(vertexFilename);
-            attach(fragmentFilename);
+            mVertexFilename   = vertexFilename;
+            mFragmentFilename = fragmentFilename;
+            makeBasicShaderFromSource(read(vertexFilename), vertexFilename,
+                                      read(fragmentFilename), fragmentFilename);
+        }
+
+        /* The same from sources, loading the linked program from the
+           program binary cache when it has one for them */
+        void makeBasicShaderFromSource(std::string const &vertexSource,
+                                       std::string const &vertexFilename,
+                                       std::string const &fragmentSource,
+                                       std::string const &fragmentFilename)
+        {
+            if (loadProgramBinary(mProgram, {vertexSource, fragmentSource})) {
+                mStatus = GL_TRUE; // the binary is only stored after a successful link
+                reflectUniforms();
+                return;
+            }
+            attachSource(vertexSource, vertexFilename);
+            attachSource(fragmentSource, fragmentFilename);
+            glProgramParameteri(mProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
             link();
+            if (mStatus) storeProgramBinary(mProgram, {vertexSource, fragmentSource});
+        }
+
+
+        /* Replaces the program with one built from new sources. If they fail
+           to compile or link the errors are printed and the current program
+           is kept. Uniform locations are reflected anew. Returns whether the
+           program was replaced */
+        bool rebuildFromSource(std::string const &vertexSource,
+                               std::string const &vertexFilename,
+                               std::string const &fragmentSource,
+                               std::string const &fragmentFilename)
+        {
+            Shader fresh;
+            fresh.mRequireSuccess = false;
+            fresh.attachSource(vertexSource, vertexFilename);
+            if (fresh.mStatus) fresh.attachSource(fragmentSource, fragmentFilename);
+            if (fresh.mStatus) {
+                glProgramParameteri(fresh.mProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+                fresh.link();
+            }
+            if (!fresh.mStatus) {
+                fresh.destroy();
+                return false;
+            }
+            std::swap(mProgram, fresh.mProgram);
+            std::swap(mLocations, fresh.mLocations);
+            fresh.destroy(); // the old program
+            storeProgramBinary(mProgram, {vertexSource, fragmentSource});
+            return true;
+        }
+
+
+        /* Rebuilds a shader made by makeBasicShader() from its files, see
+           rebuildFromSource() */
+        bool reload()
+        {
+            if (mVertexFilename.empty()) return false;
+            std::string vertexSource   = read(mVertexFilename);
+            std::string fragmentSource = read(mFragmentFilename);
+            if (vertexSource.empty() || fragmentSource.empty()) return false; // mid save, probably
+            return rebuildFromSource(vertexSource, mVertexFilename, fragmentSource, mFragmentFilename);
+        }
+
+
+        /* The files given to makeBasicShader(), if any */
+        std::vector<std::string> files() const
+        {
+            if (mVertexFilename.empty()) return {};
+            return {mVertexFilename, mFragmentFilename};
         }
 
 
@@ -125,6 +259,22 @@ namespace Gloom
         }
 
 
+        /* The contents of a shader file, empty if it can't be read */
+        static std::string read(std::string const &filename)
+        {
+            std::ifstream fd(filename.c_str());
+            if (fd.fail()) {
+                fprintf(stderr,
+                    "Something went wrong when reading the Shader file at \"%s\".\n"
+                    "The file may not exist or is currently inaccessible.\n",
+                    filename.c_str());
+                return "";
+            }
+            return std::string(std::istreambuf_iterator<char>(fd),
+                              (std::istreambuf_iterator<char>()));
+        }
+
+
         /* Helper function for creating shaders */
         GLuint create(std::string const &filename)
         {
@@ -147,8 +297,12 @@ namespace Gloom
 
         // Private member variables
         GLuint mProgram;
-        GLint  mStatus;
+        GLint  mStatus = GL_FALSE;
         GLint  mLength;
+        bool   mRequireSuccess = true; // assert on compile and link errors
+        std::string mVertexFilename;
+        std::string mFragmentFilename;
+        std::unordered_map<uint32_t, GLint> mLocations;
     };
 }
 
@@ -0,0 +1,136 @@
+#ifndef SHADER_PERMUTATIONS_HPP
+#define SHADER_PERMUTATIONS_HPP
+#pragma once
+
+// Local headers
+#include "shader.hpp"
+
+// Standard headers
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace Gloom
+{
+    /* Specialised variants of a vertex and fragment shader pair, compiled
+       with a #define for each enabled feature so branches on them are
+       resolved by the compiler. Bit i of a feature mask enables defines[i].
+       Variants are compiled on first use, or loaded from the program binary
+       cache, and kept */
+    class ShaderPermutations
+    {
+    public:
+        ShaderPermutations(std::string const &vertexFilename,
+                           std::string const &fragmentFilename,
+                           std::vector<std::string> defines = {})
+            : mVertexFilename(vertexFilename),
+              mFragmentFilename(fragmentFilename),
+              mDefines(std::move(defines)),
+              mVariants(size_t(1) << mDefines.size())
+        {
+            mVertexSource   = Shader::read(vertexFilename);
+            mFragmentSource = Shader::read(fragmentFilename);
+        }
+
+        /* The variant with exactly these features, bits without a define
+           are ignored */
+        Shader* get(uint32_t features)
+        {
+            features &= uint32_t(mVariants.size() - 1);
+            std::unique_ptr<Shader>& variant = mVariants[features];
+            if (!variant) {
+                variant.reset(new Shader());
+                std::string defines = definesFor(features);
+                variant->makeBasicShaderFromSource(
+                    inject(mVertexSource, defines), mVertexFilename,
+                    inject(mFragmentSource, defines), mFragmentFilename);
+            }
+            return variant.get();
+        }
+
+        /* Rebuilds the compiled variants from the files, keeping the old
+           program of any variant that fails, see Shader::rebuildFromSource.
+           Variants compiled later use the new files only if all succeeded */
+        bool reload()
+        {
+            std::string vertexSource   = Shader::read(mVertexFilename);
+            std::string fragmentSource = Shader::read(mFragmentFilename);
+            if (vertexSource.empty() || fragmentSource.empty()) return false; // mid save, probably
+
+            bool ok = true;
+            for (size_t features = 0; features < mVariants.size(); features++) {
+                if (!mVariants[features]) continue;
+                std::string defines = definesFor(uint32_t(features));
+                ok &= mVariants[features]->rebuildFromSource(
+                    inject(vertexSource, defines), mVertexFilename,
+                    inject(fragmentSource, defines), mFragmentFilename);
+            }
+            if (ok) {
+                mVertexSource   = vertexSource;
+                mFragmentSource = fragmentSource;
+            }
+            return ok;
+        }
+
+        std::vector<std::string> files() const
+        {
+            return {mVertexFilename, mFragmentFilename};
+        }
+
+        /* The number of variants compiled so far */
+        size_t compiled() const
+        {
+            size_t n = 0;
+            for (auto const &variant : mVariants) n += bool(variant);
+            return n;
+        }
+
+        void destroy()
+        {
+            for (auto &variant : mVariants) {
+                if (variant) variant->destroy();
+                variant.reset();
+            }
+        }
+
+    private:
+        // Disable copying and assignment
+        ShaderPermutations(ShaderPermutations const &) = delete;
+        ShaderPermutations & operator =(ShaderPermutations const &) = delete;
+
+        std::string definesFor(uint32_t features) const
+        {
+            std::string out;
+            for (size_t i = 0; i < mDefines.size(); i++)
+                if (features & (uint32_t(1) << i))
+                    out += "#define " + mDefines[i] + "\n";
+            return out;
+        }
+
+        /* The defines have to follow the #version directive. A #line
+           after them keeps the line numbers in compile errors right */
+        static std::string inject(std::string const &source, std::string const &defines)
+        {
+            size_t at = source.find("#version");
+            if (at == std::string::npos) return defines + "#line 1\n" + source;
+            at = source.find('\n', at);
+            if (at == std::string::npos) return source + "\n" + defines;
+            at++;
+            size_t line = std::count(source.begin(), source.begin() + at, '\n') + 1;
+            return source.substr(0, at) + defines
+                + "#line " + std::to_string(line) + "\n" + source.substr(at);
+        }
+
+        std::string mVertexFilename;
+        std::string mFragmentFilename;
+        std::string mVertexSource;
+        std::string mFragmentSource;
+        std::vector<std::string> mDefines;
+        std::vector<std::unique_ptr<Shader>> mVariants; // indexed by feature mask
+    };
+}
+
+#endif
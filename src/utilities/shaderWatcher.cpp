@@ -0,0 +1,124 @@
+#include "shaderWatcher.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// compares paths regardless of how they were spelled
+static std::string normalized(const std::string& path) {
+	return fs::path(path).lexically_normal().string();
+}
+
+ShaderWatcher::~ShaderWatcher() {
+	stop();
+#ifdef __linux__
+	if (inotify_fd >= 0) close(inotify_fd);
+#endif
+}
+
+void ShaderWatcher::watch(Gloom::Shader* shader) {
+	entries.push_back({shader, nullptr, shader->files()});
+	addDirectories(entries.back().files);
+}
+
+void ShaderWatcher::watch(Gloom::ShaderPermutations* shader) {
+	entries.push_back({nullptr, shader, shader->files()});
+	addDirectories(entries.back().files);
+}
+
+void ShaderWatcher::addDirectories(const std::vector<std::string>& files) {
+#ifdef __linux__
+	std::lock_guard<std::mutex> lock(mutex);
+	if (inotify_fd < 0) inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0) return;
+	for (const std::string& file : files) {
+		std::string directory = normalized(fs::path(file).parent_path().string());
+		if (directory.empty()) directory = ".";
+		bool known = std::any_of(directories.begin(), directories.end(),
+			[&](const std::pair<int, std::string>& d) { return d.second == directory; });
+		if (known) continue;
+		// editors either rewrite files in place or rename a new one over them
+		int wd = inotify_add_watch(inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (wd < 0) std::cerr << "Could not watch " << directory << " for shader changes" << std::endl;
+		else directories.push_back({wd, directory});
+	}
+#else
+	(void)files;
+#endif
+}
+
+void ShaderWatcher::start() {
+#ifdef __linux__
+	if (thread.joinable()) return;
+	stopping = false;
+	thread = std::thread(&ShaderWatcher::run, this);
+#endif
+}
+
+void ShaderWatcher::stop() {
+	if (!thread.joinable()) return;
+	stopping = true;
+	thread.join();
+}
+
+void ShaderWatcher::run() {
+#ifdef __linux__
+	alignas(inotify_event) char buffer[4096];
+	while (!stopping) {
+		int fd;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			fd = inotify_fd;
+		}
+		// wake up now and then to notice stop()
+		pollfd pfd = {fd, POLLIN, 0};
+		if (fd < 0 || ::poll(&pfd, 1, 100) <= 0) {
+			if (fd < 0) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			continue;
+		}
+		ssize_t length = read(fd, buffer, sizeof(buffer));
+		std::lock_guard<std::mutex> lock(mutex);
+		for (ssize_t i = 0; i < length;) {
+			const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + i);
+			i += sizeof(inotify_event) + event->len;
+			if (event->len == 0) continue;
+			for (const auto& directory : directories)
+				if (directory.first == event->wd)
+					changed.insert(normalized(directory.second + "/" + event->name));
+		}
+	}
+#endif
+}
+
+unsigned ShaderWatcher::poll() {
+	std::set<std::string> files;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		files.swap(changed);
+	}
+	if (files.empty()) return 0;
+
+	unsigned rebuilt = 0;
+	for (Entry& entry : entries) {
+		bool affected = std::any_of(entry.files.begin(), entry.files.end(),
+			[&](const std::string& file) { return files.count(normalized(file)); });
+		if (!affected) continue;
+
+		const std::string& name = entry.files.back();
+		bool ok = entry.shader ? entry.shader->reload() : entry.permutations->reload();
+		if (ok) rebuilt++;
+		std::cout << (ok ? "reloaded " : "kept the previous program of ") << name << std::endl;
+	}
+	return rebuilt;
+}
+
+ShaderWatcher& shaderWatcher() {
+	static ShaderWatcher watcher;
+	return watcher;
+}
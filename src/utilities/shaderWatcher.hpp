@@ -0,0 +1,54 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "shader.hpp"
+#include "shaderPermutations.hpp"
+
+// Rebuilds shaders when their files change on disk. A background thread
+// waits on inotify for writes to the directories of the watched files and
+// queues the changed paths. poll() rebuilds the affected shaders on the
+// calling thread, which has to own the GL context, so call it between
+// frames. A shader that fails to build keeps its previous program.
+// Without inotify, outside of Linux, nothing is ever reported.
+class ShaderWatcher {
+public:
+	ShaderWatcher() = default;
+	~ShaderWatcher();
+	ShaderWatcher(const ShaderWatcher&) = delete;
+	ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+
+	void watch(Gloom::Shader* shader);
+	void watch(Gloom::ShaderPermutations* shader);
+
+	// Starts the thread, files watched later are picked up as well
+	void start();
+	void stop();
+
+	// Returns the number of shaders rebuilt
+	unsigned poll();
+
+private:
+	struct Entry {
+		Gloom::Shader* shader;
+		Gloom::ShaderPermutations* permutations;
+		std::vector<std::string> files;
+	};
+
+	void addDirectories(const std::vector<std::string>& files);
+	void run();
+
+	std::vector<Entry> entries; // only touched by the GL thread
+	std::mutex mutex; // guards the members below
+	std::vector<std::pair<int, std::string>> directories; // inotify watch -> path
+	std::set<std::string> changed;
+	int inotify_fd = -1;
+	std::thread thread;
+	std::atomic<bool> stopping{false};
+};
+
+// The watcher of the shaders used by the renderer
+ShaderWatcher& shaderWatcher();
@@ -0,0 +1,113 @@
+#include "telemetry.hpp"
+#include "timeutils.hpp"
+#include <chrono>
+#include <cstdio>
+
+FrameTelemetry::~FrameTelemetry() {
+	stop();
+}
+
+void FrameTelemetry::start(const std::string& path) {
+	if (running) return;
+
+	if (!path.empty()) {
+		out.open(path);
+		if (!out) fprintf(stderr, "Could not open telemetry file \"%s\"\n", path.c_str());
+		json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+		if (json) out << "[\n";
+		else      out << "frame,dt,update_time,render_time,draw_calls,uniform_uploads,triangles,state_changes,visible_nodes,culled_nodes\n";
+	}
+
+	running = true;
+	drainer = std::thread(&FrameTelemetry::drain_loop, this);
+}
+
+void FrameTelemetry::stop() {
+	if (!running) return;
+	running = false;
+	drainer.join();
+	drain(); // whatever was pushed after the last pass
+
+	if (out.is_open()) {
+		if (json) out << "\n]\n";
+		out.close();
+	}
+
+	size_t n = update_times.size();
+	if (n == 0) return;
+	TimingStats u = summarizeTimings(update_times);
+	TimingStats r = summarizeTimings(render_times);
+	printf("telemetry: %lu frames recorded, %lu dropped\n",
+		(unsigned long)n, (unsigned long)dropped.load());
+	printf("  update  median %7.3f ms   p99 %7.3f ms\n", u.median*1000, u.p99*1000);
+	printf("  render  median %7.3f ms   p99 %7.3f ms\n", r.median*1000, r.p99*1000);
+	printf("  per frame: %.1f draw calls, %.1f uniform uploads, %.0f triangles, %.1f state changes\n",
+		double(draw_calls) / n, double(uniform_uploads) / n, double(triangles) / n, double(state_changes) / n);
+	printf("  per frame: %.1f visible meshes, %.1f culled\n",
+		double(visible_nodes) / n, double(culled_nodes) / n);
+}
+
+bool FrameTelemetry::push(const FrameRecord& record) {
+	uint64_t h = head.load(std::memory_order_relaxed);
+	if (h - tail.load(std::memory_order_acquire) >= CAPACITY) {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	ring[h & MASK] = record;
+	head.store(h + 1, std::memory_order_release);
+	return true;
+}
+
+void FrameTelemetry::drain_loop() {
+	while (running) {
+		drain();
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+}
+
+void FrameTelemetry::drain() {
+	uint64_t t = tail.load(std::memory_order_relaxed);
+	uint64_t h = head.load(std::memory_order_acquire);
+	for (; t != h; t++) {
+		const FrameRecord& record = ring[t & MASK];
+		update_times.push_back(record.update_time);
+		render_times.push_back(record.render_time);
+		draw_calls      += record.draw_calls;
+		uniform_uploads += record.uniform_uploads;
+		triangles       += record.triangles;
+		state_changes   += record.state_changes;
+		visible_nodes   += record.visible_nodes;
+		culled_nodes    += record.culled_nodes;
+		if (out.is_open()) write(record);
+	}
+	tail.store(t, std::memory_order_release);
+	if (out.is_open()) out.flush();
+}
+
+void FrameTelemetry::write(const FrameRecord& r) {
+	if (json) {
+		if (written) out << ",\n";
+		out << "  {\"frame\": " << r.frame
+			<< ", \"dt\": " << r.dt
+			<< ", \"update_time\": " << r.update_time
+			<< ", \"render_time\": " << r.render_time
+			<< ", \"draw_calls\": " << r.draw_calls
+			<< ", \"uniform_uploads\": " << r.uniform_uploads
+			<< ", \"triangles\": " << r.triangles
+			<< ", \"state_changes\": " << r.state_changes
+			<< ", \"visible_nodes\": " << r.visible_nodes
+			<< ", \"culled_nodes\": " << r.culled_nodes << "}";
+	} else {
+		out << r.frame << ','
+			<< r.dt << ','
+			<< r.update_time << ','
+			<< r.render_time << ','
+			<< r.draw_calls << ','
+			<< r.uniform_uploads << ','
+			<< r.triangles << ','
+			<< r.state_changes << ','
+			<< r.visible_nodes << ','
+			<< r.culled_nodes << '\n';
+	}
+	written++;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One frame worth of measurements
+struct FrameRecord {
+	uint64_t frame = 0;
+	double dt          = 0; // scene time delta, in seconds
+	double update_time = 0; // step_scene + updateFrame, in seconds
+	double render_time = 0; // renderFrame, in seconds
+	uint32_t draw_calls      = 0;
+	uint32_t uniform_uploads = 0;
+	uint32_t triangles       = 0;
+	uint32_t state_changes   = 0;
+	uint32_t visible_nodes   = 0;
+	uint32_t culled_nodes    = 0;
+};
+
+// Collects FrameRecords from the render thread without locking or allocating.
+// Records are written into a fixed size single-producer single-consumer ring
+// buffer, which a background thread drains to a CSV or JSON file (picked by
+// the file extension) and into a summary printed by stop().
+// If the drainer falls behind, records are dropped rather than blocking.
+class FrameTelemetry {
+public:
+	FrameTelemetry() = default;
+	~FrameTelemetry();
+
+	// `path` may be empty, in which case only the summary is produced
+	void start(const std::string& path = "");
+	void stop();
+
+	// Called from the render thread only
+	bool push(const FrameRecord& record);
+
+private:
+	static constexpr size_t CAPACITY = 1 << 12; // must be a power of two
+	static constexpr size_t MASK = CAPACITY - 1;
+
+	void drain_loop();
+	void drain();
+	void write(const FrameRecord& record);
+
+	FrameRecord ring[CAPACITY];
+	alignas(64) std::atomic<uint64_t> head{0}; // next slot to write, owned by the producer
+	alignas(64) std::atomic<uint64_t> tail{0}; // next slot to read, owned by the consumer
+	alignas(64) std::atomic<uint64_t> dropped{0};
+	std::atomic<bool> running{false};
+	std::thread drainer;
+
+	// only touched by the drainer (and by stop() once it has joined)
+	std::ofstream out;
+	bool json = false;
+	uint64_t written = 0;
+	std::vector<double> update_times, render_times;
+	uint64_t draw_calls = 0, uniform_uploads = 0, triangles = 0, state_changes = 0;
+	uint64_t visible_nodes = 0, culled_nodes = 0;
+};
@@ -0,0 +1,354 @@
+#include "textureCompression.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+#include "jobSystem.hpp"
+
+namespace fs = std::filesystem;
+using std::vector;
+
+// Bump whenever the encoder or the cache layout changes
+static const uint32_t kTextureCacheVersion = 2;
+
+// The cache file: this header, then for each level of the mip chain, from
+// the largest down, its size in bytes and its blocks, like KTX
+struct TextureCacheHeader {
+    char     magic[4]; // "TDTC"
+    uint32_t version;
+    uint64_t source_size;  // of the PNG file, encoded again when it
+    int64_t  source_mtime; // changes
+    uint32_t options;      // TextureCompression | flip_handedness << 8
+    uint32_t format;       // BlockFormat
+    uint32_t width;
+    uint32_t height;
+    uint32_t levels;
+    uint32_t _pad;
+};
+static_assert(sizeof(TextureCacheHeader) == 48, "texture cache layout mismatch");
+
+size_t blockBytes(BlockFormat format) {
+    return (format == BLOCK_BC1) ? 8 : 16;
+}
+
+static size_t levelBytes(BlockFormat format, uint width, uint height) {
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+static uint levelCount(uint width, uint height) {
+    uint levels = 1;
+    while ((std::max(width, height) >> levels) > 0) levels++;
+    return levels;
+}
+
+BlockFormat chooseBlockFormat(const PNGImage& image, TextureCompression compression) {
+    if (compression == COMPRESS_NORMALS) return BLOCK_BC5;
+    return (image.alpha_mode == ALPHA_OPAQUE) ? BLOCK_BC1 : BLOCK_BC3;
+}
+
+// 4x4 RGBA texels starting at block (bx, by), repeating the last row and
+// column past the edges
+static void fetchBlock(const unsigned char* pixels, uint width, uint height, uint bx, uint by, uint8_t texels[16][4]) {
+    for (uint y = 0; y < 4; y++)
+    for (uint x = 0; x < 4; x++) {
+        uint sx = std::min(bx*4 + x, width  - 1);
+        uint sy = std::min(by*4 + y, height - 1);
+        memcpy(texels[y*4 + x], pixels + (size_t(sy) * width + sx) * 4, 4);
+    }
+}
+
+static uint16_t to565(const uint8_t c[4]) {
+    return uint16_t(((c[0] * 31 + 127) / 255) << 11
+                  | ((c[1] * 63 + 127) / 255) << 5
+                  |  (c[2] * 31 + 127) / 255);
+}
+static void from565(uint16_t c, int out[3]) {
+    int r = c >> 11, g = (c >> 5) & 63, b = c & 31;
+    out[0] = (r << 3) | (r >> 2);
+    out[1] = (g << 2) | (g >> 4);
+    out[2] = (b << 3) | (b >> 2);
+}
+
+// Two 565 endpoints at the extremes of the block along its principal axis,
+// and a 2 bit index into the four colors on the line between them per texel.
+// Always in four color mode, the only one BC3 has.
+static void encodeColorBlock(const uint8_t texels[16][4], uint8_t out[8]) {
+    float mean[3] = {};
+    for (uint i = 0; i < 16; i++)
+        for (uint c = 0; c < 3; c++) mean[c] += texels[i][c] / 16.0f;
+
+    float cov[6] = {}; // rr rg rb gg gb bb
+    for (uint i = 0; i < 16; i++) {
+        float r = texels[i][0] - mean[0], g = texels[i][1] - mean[1], b = texels[i][2] - mean[2];
+        cov[0] += r*r; cov[1] += r*g; cov[2] += r*b;
+        cov[3] += g*g; cov[4] += g*b; cov[5] += b*b;
+    }
+    // A few rounds of power iteration is plenty for the principal axis. It
+    // starts along the channel varying the most, which can't be orthogonal
+    // to the axis the way a fixed start like (1,1,1) can, e.g. for a red
+    // and green block. Without any variance the axis doesn't matter.
+    float axis[3] = {0, 0, 0};
+    const float variance[3] = {cov[0], cov[3], cov[5]};
+    axis[std::max_element(variance, variance + 3) - variance] = 1;
+    const float trace = cov[0] + cov[3] + cov[5];
+    for (uint it = 0; it < 4 && trace > 1e-3f; it++) {
+        float v[3] = {
+            cov[0]*axis[0] + cov[1]*axis[1] + cov[2]*axis[2],
+            cov[1]*axis[0] + cov[3]*axis[1] + cov[4]*axis[2],
+            cov[2]*axis[0] + cov[4]*axis[1] + cov[5]*axis[2],
+        };
+        float m = std::max({std::fabs(v[0]), std::fabs(v[1]), std::fabs(v[2])});
+        if (m < 1e-6f * trace) break; // keep the last axis
+        for (uint c = 0; c < 3; c++) axis[c] = v[c] / m;
+    }
+
+    uint lo = 0, hi = 0;
+    float lo_d = INFINITY, hi_d = -INFINITY;
+    for (uint i = 0; i < 16; i++) {
+        float d = texels[i][0]*axis[0] + texels[i][1]*axis[1] + texels[i][2]*axis[2];
+        if (d < lo_d) { lo_d = d; lo = i; }
+        if (d > hi_d) { hi_d = d; hi = i; }
+    }
+    uint16_t c0 = to565(texels[hi]);
+    uint16_t c1 = to565(texels[lo]);
+    if (c0 < c1) std::swap(c0, c1); // c0 > c1 is four color mode in BC1
+
+    out[0] = c0 & 0xff; out[1] = c0 >> 8;
+    out[2] = c1 & 0xff; out[3] = c1 >> 8;
+    uint32_t indices = 0;
+    if (c0 != c1) {
+        int palette[4][3];
+        from565(c0, palette[0]);
+        from565(c1, palette[1]);
+        for (uint c = 0; c < 3; c++) {
+            palette[2][c] = (2*palette[0][c] +   palette[1][c]) / 3;
+            palette[3][c] = (  palette[0][c] + 2*palette[1][c]) / 3;
+        }
+        for (uint i = 0; i < 16; i++) {
+            uint best = 0;
+            int best_error = INT32_MAX;
+            for (uint p = 0; p < 4; p++) {
+                int error = 0;
+                for (uint c = 0; c < 3; c++) {
+                    int d = texels[i][c] - palette[p][c];
+                    error += d*d;
+                }
+                if (error < best_error) { best_error = error; best = p; }
+            }
+            indices |= best << (2*i);
+        }
+    }
+    for (uint i = 0; i < 4; i++) out[4 + i] = uint8_t(indices >> (8*i));
+}
+
+// The range of one channel of the block, and a 3 bit index into eight
+// values spread over it per texel. Used for alpha in BC3, and for each of
+// red and green in BC5.
+static void encodeChannelBlock(const uint8_t texels[16][4], uint channel, uint8_t out[8]) {
+    int lo = 255, hi = 0;
+    for (uint i = 0; i < 16; i++) {
+        lo = std::min<int>(lo, texels[i][channel]);
+        hi = std::max<int>(hi, texels[i][channel]);
+    }
+    out[0] = uint8_t(hi);
+    out[1] = uint8_t(lo);
+    uint64_t indices = 0;
+    if (hi != lo) {
+        int palette[8] = {hi, lo};
+        for (uint i = 1; i < 7; i++) palette[i + 1] = ((7 - i)*hi + i*lo + 3) / 7;
+        for (uint i = 0; i < 16; i++) {
+            uint best = 0;
+            int best_error = INT32_MAX;
+            for (uint p = 0; p < 8; p++) {
+                int error = std::abs(texels[i][channel] - palette[p]);
+                if (error < best_error) { best_error = error; best = p; }
+            }
+            indices |= uint64_t(best) << (3*i);
+        }
+    }
+    for (uint i = 0; i < 6; i++) out[2 + i] = uint8_t(indices >> (8*i));
+}
+
+vector<uint8_t> encodeBlocks(const vector<unsigned char>& pixels, uint width, uint height, BlockFormat format, JobSystem* jobs) {
+    const uint blocks_x = (width + 3) / 4, blocks_y = (height + 3) / 4;
+    const size_t bytes = blockBytes(format);
+    vector<uint8_t> out(size_t(blocks_x) * blocks_y * bytes);
+    if (out.empty()) return out;
+
+    auto encodeRows = [&](size_t begin, size_t end) {
+        uint8_t texels[16][4];
+        for (size_t by = begin; by < end; by++)
+        for (uint bx = 0; bx < blocks_x; bx++) {
+            fetchBlock(pixels.data(), width, height, bx, uint(by), texels);
+            uint8_t* block = out.data() + (by * blocks_x + bx) * bytes;
+            switch (format) {
+            case BLOCK_BC1:
+                encodeColorBlock(texels, block);
+                break;
+            case BLOCK_BC3:
+                encodeChannelBlock(texels, 3, block);
+                encodeColorBlock(texels, block + 8);
+                break;
+            case BLOCK_BC5:
+                encodeChannelBlock(texels, 0, block);
+                encodeChannelBlock(texels, 1, block + 8);
+                break;
+            }
+        }
+    };
+    if (jobs) jobs->parallelFor(blocks_y, 16, encodeRows);
+    else encodeRows(0, blocks_y);
+    return out;
+}
+
+// Halves the image with a box filter. Normals are averaged as vectors and
+// renormalized, so the smaller levels don't flatten the surface.
+static vector<unsigned char> downsample(const vector<unsigned char>& pixels, uint width, uint height, bool normals) {
+    const uint w = std::max(1u, width / 2), h = std::max(1u, height / 2);
+    vector<unsigned char> out(size_t(w) * h * 4);
+    for (uint y = 0; y < h; y++)
+    for (uint x = 0; x < w; x++) {
+        const unsigned char* p[4];
+        for (uint i = 0; i < 4; i++) {
+            uint sx = std::min(2*x + (i & 1),  width  - 1);
+            uint sy = std::min(2*y + (i >> 1), height - 1);
+            p[i] = pixels.data() + (size_t(sy) * width + sx) * 4;
+        }
+        unsigned char* o = out.data() + (size_t(y) * w + x) * 4;
+        for (uint c = 0; c < 4; c++)
+            o[c] = (p[0][c] + p[1][c] + p[2][c] + p[3][c] + 2) / 4;
+        if (!normals) continue;
+
+        float n[3] = {};
+        for (uint i = 0; i < 4; i++)
+            for (uint c = 0; c < 3; c++) n[c] += p[i][c] / 127.5f - 1;
+        float length = std::sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+        if (length < 1e-6f) continue;
+        for (uint c = 0; c < 3; c++)
+            o[c] = uint8_t(std::clamp((n[c] / length + 1) * 127.5f + 0.5f, 0.0f, 255.0f));
+    }
+    return out;
+}
+
+CompressedTexture compressTexture(const PNGImage& image, BlockFormat format, JobSystem* jobs) {
+    CompressedTexture out;
+    out.format = format;
+    out.width  = image.width;
+    out.height = image.height;
+
+    const vector<unsigned char>* level = &image.pixels;
+    vector<unsigned char> smaller;
+    uint w = image.width, h = image.height;
+    while (true) {
+        out.levels.push_back(encodeBlocks(*level, w, h, format, jobs));
+        if (w == 1 && h == 1) break;
+        smaller = downsample(*level, w, h, format == BLOCK_BC5);
+        level = &smaller;
+        w = std::max(1u, w / 2);
+        h = std::max(1u, h / 2);
+    }
+    return out;
+}
+
+std::string compressedTexturePath(const std::string& filename, bool flip_handedness, TextureCompression compression) {
+    return filename
+        + (flip_handedness ? ".flipped" : "")
+        + (compression == COMPRESS_NORMALS ? ".normals" : ".color")
+        + ".bctex";
+}
+
+static TextureCacheHeader makeHeader(const std::string& filename, uint32_t options, BlockFormat format, uint width, uint height) {
+    TextureCacheHeader header = {};
+    memcpy(header.magic, "TDTC", 4);
+    header.version = kTextureCacheVersion;
+    std::error_code error;
+    header.source_size = fs::file_size(filename, error);
+    if (error) header.source_size = 0;
+    auto time = fs::last_write_time(filename, error);
+    header.source_mtime = error ? 0 : int64_t(time.time_since_epoch().count());
+    header.options = options;
+    header.format  = format;
+    header.width   = width;
+    header.height  = height;
+    header.levels  = levelCount(width, height);
+    return header;
+}
+
+static bool readCache(const std::string& path, const TextureCacheHeader& expected, CompressedTexture& out) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    TextureCacheHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+            || memcmp(&header, &expected, sizeof(header)) != 0)
+        return false;
+
+    out.format = BlockFormat(header.format);
+    out.width  = header.width;
+    out.height = header.height;
+    out.levels.resize(header.levels);
+    uint w = header.width, h = header.height;
+    for (vector<uint8_t>& level : out.levels) {
+        uint32_t bytes;
+        if (!file.read(reinterpret_cast<char*>(&bytes), sizeof(bytes))
+                || bytes != levelBytes(out.format, w, h))
+            return false;
+        level.resize(bytes);
+        if (!file.read(reinterpret_cast<char*>(level.data()), bytes)) return false;
+        w = std::max(1u, w / 2);
+        h = std::max(1u, h / 2);
+    }
+    return true;
+}
+
+// through a temporary file, like writeBakedModel()
+static bool writeCache(const std::string& path, const TextureCacheHeader& header, const CompressedTexture& texture) {
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const vector<uint8_t>& level : texture.levels) {
+            uint32_t bytes = uint32_t(level.size());
+            out.write(reinterpret_cast<const char*>(&bytes), sizeof(bytes));
+            out.write(reinterpret_cast<const char*>(level.data()), bytes);
+        }
+        if (!out) return false;
+    }
+    std::error_code error;
+    fs::rename(tmp, path, error);
+    if (error) {
+        fs::remove(tmp, error);
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<const CompressedTexture> loadCompressedTexture(
+        const PNGImage& image,
+        const std::string& filename,
+        bool flip_handedness,
+        TextureCompression compression,
+        JobSystem* jobs) {
+    if (compression == UNCOMPRESSED || image.width == 0 || image.height == 0) return nullptr;
+
+    const BlockFormat format = chooseBlockFormat(image, compression);
+    const TextureCacheHeader header = makeHeader(filename,
+        uint32_t(compression) | uint32_t(flip_handedness) << 8, format, image.width, image.height);
+    const std::string path = compressedTexturePath(filename, flip_handedness, compression);
+
+    auto texture = std::make_shared<CompressedTexture>();
+    if (readCache(path, header, *texture)) return texture;
+
+    *texture = compressTexture(image, format, jobs);
+    if (!writeCache(path, header, *texture))
+        fprintf(stderr, "Unable to write %s\n", path.c_str());
+
+    size_t bytes = 0;
+    for (const vector<uint8_t>& level : texture->levels) bytes += level.size();
+    printf("texture '%s': BC%u, %.2f MB -> %.2f MB with mipmaps\n", filename.c_str(),
+        uint(format), image.pixels.size() * 4 / 3 / 1e6, bytes / 1e6);
+    return texture;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "imageLoader.hpp"
+
+// Block compressed formats, each encoding 4x4 texels at a time
+enum BlockFormat : uint32_t {
+    BLOCK_BC1 = 1, // RGB, 8 bytes per block
+    BLOCK_BC3 = 3, // RGBA, 16 bytes per block, BC1 colors and interpolated alpha
+    BLOCK_BC5 = 5, // RG, 16 bytes per block, two BC3 style alpha blocks
+};
+
+struct CompressedTexture {
+    BlockFormat format;
+    uint width, height;
+    std::vector<std::vector<uint8_t>> levels; // the full mip chain, down to 1x1
+};
+
+size_t blockBytes(BlockFormat format);
+
+// BC1 for opaque color textures, BC3 for others, BC5 for normal maps, which
+// keeps only x and y of the normals. The shader reconstructs z.
+BlockFormat chooseBlockFormat(const PNGImage& image, TextureCompression compression);
+
+// Encodes every 4x4 block of `pixels`, clamping at the edges. The rows of
+// blocks are spread over `jobs` if given, else encoded on this thread. When
+// loading assets, pass the asset loader's pool, never jobSystem(), whose
+// jobs the render thread runs while it waits on its own.
+std::vector<uint8_t> encodeBlocks(const std::vector<unsigned char>& pixels, uint width, uint height, BlockFormat format, JobSystem* jobs = nullptr);
+
+// Downsamples the image into a full mip chain and encodes each level. The
+// levels of normal maps are renormalized.
+CompressedTexture compressTexture(const PNGImage& image, BlockFormat format, JobSystem* jobs = nullptr);
+
+// The compressed form of `image`, decoded from `filename`, read from a
+// cache next to the file or encoded and written there. Like baked models,
+// the cache is encoded again when the source file changes.
+std::shared_ptr<const CompressedTexture> loadCompressedTexture(
+    const PNGImage& image,
+    const std::string& filename,
+    bool flip_handedness,
+    TextureCompression compression,
+    JobSystem* jobs = nullptr);
+
+// where loadCompressedTexture() keeps the compressed form of a file, one
+// per way of loading it, so a file used in several ways isn't encoded again
+// on every run
+std::string compressedTexturePath(const std::string& filename, bool flip_handedness, TextureCompression compression);
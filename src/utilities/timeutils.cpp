@@ -1,4 +1,6 @@
 #include "timeutils.hpp"
+#include <algorithm>
+#include <cmath>
 
 Clock::Clock() {
 	_prev = std::chrono::steady_clock::now();
@@ -15,3 +17,19 @@ double Clock::getTimeDeltaSeconds() {
 
 	return ((double)td) / 1000000000.0; // return as seconds
 }
+
+TimingStats summarizeTimings(std::vector<double>& samples) {
+	TimingStats out;
+	if (samples.empty()) return out;
+
+	std::sort(samples.begin(), samples.end());
+	size_t n = samples.size();
+
+	out.min    = samples.front();
+	out.max    = samples.back();
+	out.median = (n % 2) ? samples[n/2] : (samples[n/2 - 1] + samples[n/2]) / 2;
+	out.p99    = samples[size_t(std::ceil(n * 0.99)) - 1]; // nearest rank
+	for (double s : samples) out.mean += s;
+	out.mean /= n;
+	return out;
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <chrono>
+#include <vector>
 
 class Clock {
 private:
@@ -11,3 +12,15 @@ public:
 	// Calculates the elapsed time since the previous time this function was called.
 	double getTimeDeltaSeconds();
 };
+
+// Summary of a series of timing samples, all in seconds
+struct TimingStats {
+	double min    = 0;
+	double median = 0;
+	double p99    = 0;
+	double mean   = 0;
+	double max    = 0;
+};
+
+// sorts `samples` in place
+TimingStats summarizeTimings(std::vector<double>& samples);
@@ -16,4 +16,14 @@ const int         c_windowSamples   = 4;
 struct CommandLineOptions {
     bool enableMusic;
     bool enableAutoplay;
+    bool headless;          // render to a hidden window
+    int benchmarkFrames;    // if > 0, run this many frames and print timings
+    float fixedTimeDelta;   // if > 0, step the scene with this instead of the wall clock
+    std::string telemetryPath; // per-frame records are written here (.csv or .json), if set
+    std::string microBenchmark; // if set, run this micro-benchmark instead of the scene
+    int grassCount;         // number of grass clones scattered over the terrain
+    int threads;            // size of the job system, 0 means one per core
+    bool oit;               // start with weighted blended OIT, toggled with O
+    bool mdi;               // start with multi-draw indirect submission, toggled with M
+    std::string shaderCachePath; // linked program binaries are cached here, if set
 };